@@ -67,6 +67,17 @@ struct IFMatrix {
         return this->findex();
     }
   };
+  /*! \brief column iterator that goes backward */
+  struct ColBackIter: public ColIter{
+    ColBackIter( const REntry* dptr, const REntry* end )
+        :ColIter( dptr, end ){}
+    inline bool Next( void ){
+        if( dptr_ == end_ ) return false;
+        else{
+           -- dptr_; return true;
+        }
+    }
+  };
  public:
   // the following are column meta data, should be able to answer them fast
   /*! \return whether column access is enabled */
@@ -79,6 +90,12 @@ struct IFMatrix {
    * \return column iterator
    */
   virtual ColIter GetSortedCol(size_t ridx) const = 0;
+  /*!
+   * \brief get column iterator that visits the column in descending order of feature value
+   * \param ridx column index
+   * \return column iterator
+   */
+  virtual ColBackIter GetReverseSortedCol(size_t ridx) const = 0;
   /*! \return number of columns in the FMatrix */
   virtual size_t NumCol(void) const = 0;
   // virtual destructor
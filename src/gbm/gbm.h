@@ -14,11 +14,14 @@
 #include "../utils/fmap.h"
 #include "../utils/utils.h"
 #include "../utils/config.h"
+#include "../tree/tree_model.h"
 
 /*! \brief namespace for xboost package */
 namespace xgboost{
 /*! \brief namespace for gradient booster */
 namespace gbm {
+class HistIndexCache;
+class ThreadWorkspace;
 /*! 
 * \brief interface of a gradient boosting learner 
 * \tparam IFMatrix the feature matrix format that the booster takes
@@ -60,6 +63,21 @@ class IGradBooster {
                        std::vector<float> &hess,
                        const IFMatrix &feats,
                        const std::vector<unsigned> &root_index) = 0;
+  /*!
+   * \brief recompute the statistics and the leaf values of the booster from new gradients,
+   *        the structure learned before is kept, used by process_type=refresh
+   * \param grad first order gradient of each instance
+   * \param hess second order gradient of each instance
+   * \param feats features of each instance
+   * \param root_index pre-partitioned root index of each instance,
+   *          root_index.size() can be 0 which indicates that no pre-partition involved
+   */
+  virtual void Refresh(const std::vector<float> &grad,
+                       const std::vector<float> &hess,
+                       const IFMatrix &feats,
+                       const std::vector<unsigned> &root_index) {
+    utils::Error("not implemented");
+  }
   /*! 
    * \brief predict the path ids along a trees, for given sparse feature vector. When booster is a tree
    * \param path the result of path
@@ -98,6 +116,25 @@ class IGradBooster {
     utils::Error("not implemented");
     return 0.0f;
   }
+  /*!
+   * \brief set the cache of the quantized training data, owned by the model,
+   *        the boosters are created every round and can not keep it themselves
+   * \param cache the cache, NULL makes the booster use a cache of its own
+   */
+  virtual void SetDataCache(HistIndexCache *cache) {}
+  /*!
+   * \brief set the per thread scratch space, owned by the model and shared by all its boosters,
+   *        a booster uses it in prediction and in training and keeps no scratch of its own
+   * \param ws the workspace, it must outlive the booster
+   */
+  virtual void SetThreadWorkspace(ThreadWorkspace *ws) {}
+  /*!
+   * \brief get the tree of a tree booster, used to build the inference layout of the model
+   * \return the tree, NULL if the booster is not a tree
+   */
+  virtual const RegTree *GetTree(void) const {
+    return NULL;
+  }
   /*! 
    * \brief print information
    * \param fo output stream 
@@ -2,10 +2,15 @@
 #define XGBOOST_GBMBASE_H
 
 #include <cstring>
+#include <algorithm>
 #include "gbm.h"
 #include "../data.h"
 //#include "../utils/xgboost_omp.h"
 #include "../utils/config.h"
+#include "../tree/tree_ensemble.h"
+#include "../tree/quick_scorer.h"
+#include "../tree/hist_util.h"
+#include "../tree/thread_workspace.h"
 /*!
  * \file xgboost_gbmbase.h
  * \brief a base model class, 
@@ -25,7 +30,15 @@ namespace gbm {
 class GBTree {
  public:
   /*! \brief number of thread used */
-  GBTree(void) {}
+  GBTree(void) {
+    process_type = kDefault;
+    num_refreshed = 0;
+    num_pbuffer = 0;
+    use_quick_scorer = 1;
+    quick_scorer_ok = true;
+    simd_level = FlatTreeEnsemble::DetectSIMD();
+    threadtemp.Init();
+  }
   /*! \brief destructor */
   virtual ~GBTree(void) {
     this->FreeSpace();
@@ -42,6 +55,17 @@ class GBTree {
     if (!strcmp(name, "silent")) {
       this->SetParam("bst:silent", val);
     }
+    if (!strcmp(name, "process_type")) {
+      if (!strcmp(val, "default")) process_type = kDefault;
+      else if (!strcmp(val, "refresh")) process_type = kRefresh;
+      else utils::Error("unknown process_type %s", val);
+    }
+    if (!strcmp(name, "quick_scorer")) use_quick_scorer = atoi(val);
+    if (!strcmp(name, "simd_traversal")) {
+      simd_level = atoi(val) != 0 ? FlatTreeEnsemble::DetectSIMD() : FlatTreeEnsemble::kScalar;
+    }
+    // the buffer of a loaded model is sized for its training data, a refresh pass resizes it
+    if (!strcmp(name, "num_pbuffer")) num_pbuffer = atoi(val);
     if (boosters.size() == 0) mparam.SetParam( name, val );
   }
   /*! 
@@ -69,8 +93,14 @@ class GBTree {
     boosters.resize( mparam.num_boosters );
     for( size_t i = 0; i < boosters.size(); i ++ ){
       boosters[ i ] = CreateBooster( mparam.booster_type );
+      boosters[ i ]->SetThreadWorkspace( &threadtemp );
       boosters[ i ]->LoadModel( fi );
     }
+    // prediction runs inside the parallel loops of the caller, the scratch is sized beforehand
+    threadtemp.Init();
+    // pack the trees for prediction once, the trees added by training are appended when used,
+    // the quick scorer is built by the first unbuffered prediction
+    this->SyncFlat(boosters.size());
     if( mparam.num_pbuffer != 0 ){
         pred_buffer.resize ( mparam.num_pbuffer );
         pred_counter.resize( mparam.num_pbuffer );
@@ -85,6 +115,8 @@ class GBTree {
     pred_buffer.clear(); pred_counter.clear();
     pred_buffer.resize(mparam.num_pbuffer, 0.0f);
     pred_counter.resize(mparam.num_pbuffer, 0);
+    this->ClearInference();
+    threadtemp.Init();
     utils::Assert(mparam.num_boosters == 0);
     utils::Assert(boosters.size() == 0);
   }
@@ -97,6 +129,15 @@ class GBTree {
     for (size_t i = 0; i < this->boosters.size(); ++i) {
       this->ConfigBooster(this->boosters[i]);
     }
+    if (process_type == kRefresh) {
+      utils::Check(boosters.size() != 0, "process_type=refresh needs a model to refresh");
+      // the buffered predictions hold the boosters refreshed so far, none yet
+      num_refreshed = 0;
+      mparam.num_pbuffer = num_pbuffer;
+      pred_buffer.clear(); pred_counter.clear();
+      pred_buffer.resize(mparam.num_pbuffer, 0.0f);
+      pred_counter.resize(mparam.num_pbuffer, 0);
+    }
   }
   /*! 
    * \brief do gradient boost training for one step, using the information given
@@ -111,7 +152,18 @@ class GBTree {
                       std::vector<float> &hess,
                       const IFMatrix &feats,
                       const std::vector<unsigned> &root_index) {
+    if (process_type == kRefresh) {
+      // each round refreshes the next booster of the loaded model
+      utils::Check(num_refreshed < boosters.size(),
+                   "process_type=refresh: num_round exceeds the number of boosters in the model");
+      if (num_refreshed < flat.NumTree()) this->ClearInference();
+      boosters[num_refreshed]->Refresh(grad, hess, feats, root_index);
+      ++num_refreshed;
+      return;
+    }
     IGradBooster *bst = this->GetUpdateBooster();
+    // a booster updated again is packed again
+    if (boosters.size() <= flat.NumTree()) this->ClearInference();
     bst->DoBoost(grad, hess, feats, root_index);
   }
   /*! 
@@ -134,30 +186,179 @@ class GBTree {
       psum = this->pred_buffer[buffer_index];
     }
 
-    for (size_t i = istart; i < this->boosters.size(); ++i) {
+    const size_t nbooster = this->NumPredBooster();
+    for (size_t i = istart; i < nbooster; ++i) {
       psum += this->boosters[i]->Predict(feats, row_index, root_index);
     }                
     // updated the buffered results
     if (mparam.do_reboost == 0 && buffer_index >= 0) {
-      this->pred_counter[buffer_index] = static_cast<unsigned>(boosters.size());
+      this->pred_counter[buffer_index] = static_cast<unsigned>(nbooster);
       this->pred_buffer[buffer_index] = psum;
     }
     return psum;
   }
-            
+  /*!
+   * \brief predict values for all the rows of a feature matrix,
+   *        the rows are taken in tiles that go through every booster together,
+   *        so the nodes of a tree stay in cache for all the rows of the tile,
+   *        and each row is loaded into a dense feature vector once for all the trees
+   * \param feats feature matrix
+   * \param root_index root id of each row, can be empty, which means root 0 for all rows
+   * \param buffer_offset buffer index of the first row, -1 means no buffer assigned
+   * \param preds output, prediction of each row, preds.size() gives the number of rows
+   */
+  inline void PredictBatch(const FMatrixS &feats, const std::vector<unsigned> &root_index,
+                           int buffer_offset, std::vector<float> &preds) {
+    const long nrow = static_cast<long>(preds.size());
+    // only the tree booster has a dense predict
+    if (mparam.booster_type != 0) {
+      #pragma omp parallel for schedule(static)
+      for (long j = 0; j < nrow; ++j) {
+        preds[j] = this->Predict(feats, static_cast<bst_uint>(j),
+                                 buffer_offset < 0 ? -1 : buffer_offset + static_cast<int>(j),
+                                 root_index.size() == 0 ? 0 : root_index[j]);
+      }
+      return;
+    }
+    const size_t nfeat = feats.NumCol();
+    // rows of a tile, fewer when the dense vectors of a full tile would not fit in cache
+    const long tile = static_cast<long>(std::max(static_cast<size_t>(1),
+        std::min(static_cast<size_t>(kTileRow), kTileBytes / (nfeat * sizeof(float) + 1))));
+    const long ntile = (nrow + tile - 1) / tile;
+    const size_t nbooster = this->NumPredBooster();
+    const bool use_buffer = mparam.do_reboost == 0 && buffer_offset >= 0;
+    this->SyncFlat(nbooster);
+    utils::Assert(flat.NumTree() >= nbooster, "PredictBatch: boosters missing in the inference layout");
+    // buffered rows only need the trees added since their last prediction, the quick scorer
+    // would scan the splits of all the trees for them, it is only used when every row needs every tree
+    const bool use_qs = !use_buffer && this->SyncQuickScorer(nbooster);
+    #pragma omp parallel
+    {
+      // dense features of the rows of the tile, one row after the other,
+      // one column at least so that the rows point into the buffers when there is no feature
+      std::vector<float> fblock(tile * std::max(nfeat, static_cast<size_t>(1)));
+      std::vector<int> mblock(tile * std::max(nfeat, static_cast<size_t>(1)), 1);
+      std::vector<size_t> istart(tile);
+      std::vector<uint64_t> qv;
+      #pragma omp for schedule(static)
+      for (long t = 0; t < ntile; ++t) {
+        const long begin = t * tile, end = std::min(nrow, begin + tile);
+        size_t imin = nbooster;
+        for (long j = begin; j < end; ++j) {
+          const long k = j - begin;
+          for (IFMatrix::RowIter it = feats.GetRow(j); it.Next();) {
+            fblock[k * nfeat + it.findex()] = it.fvalue(); mblock[k * nfeat + it.findex()] = 0;
+          }
+          // load buffered results if any
+          istart[k] = 0; preds[j] = 0.0f;
+          if (use_buffer) {
+            const int bidx = buffer_offset + static_cast<int>(j);
+            utils::Assert(bidx < mparam.num_pbuffer, "buffer index exceed num_pbuffer");
+            istart[k] = pred_counter[bidx];
+            preds[j] = pred_buffer[bidx];
+          }
+          imin = std::min(imin, istart[k]);
+        }
+        if (use_qs && imin == 0) {
+          for (long j = begin; j < end; ++j) {
+            const long k = j - begin;
+            preds[j] = qscorer.Predict(DenseRow<float>(&fblock[k * nfeat], nfeat),
+                                       DenseRow<int>(&mblock[k * nfeat], nfeat), preds[j], qv);
+          }
+        } else {
+          const size_t imax = *std::max_element(istart.begin(), istart.begin() + (end - begin));
+          const unsigned *gid = root_index.size() == 0 ? NULL : &root_index[begin];
+          for (size_t i = imin; i < nbooster; ++i) {
+            // the rows of the tile go through the tree together once all of them need it
+            if (i >= imax) {
+              flat.PredictBlock(i, &fblock[0], &mblock[0], nfeat, end - begin, gid, &preds[begin], simd_level);
+              continue;
+            }
+            for (long j = begin; j < end; ++j) {
+              const long k = j - begin;
+              if (i < istart[k]) continue;
+              preds[j] += flat.Predict(i, DenseRow<float>(&fblock[k * nfeat], nfeat),
+                                       DenseRow<int>(&mblock[k * nfeat], nfeat),
+                                       root_index.size() == 0 ? 0 : root_index[j]);
+            }
+          }
+        }
+        for (long j = begin; j < end; ++j) {
+          const long k = j - begin;
+          // updated the buffered results
+          if (use_buffer) {
+            const int bidx = buffer_offset + static_cast<int>(j);
+            pred_counter[bidx] = static_cast<unsigned>(nbooster);
+            pred_buffer[bidx] = preds[j];
+          }
+          for (IFMatrix::RowIter it = feats.GetRow(j); it.Next();) {
+            mblock[k * nfeat + it.findex()] = 1;
+          }
+        }
+      }
+    }
+  }
+  /*! \brief forget the quantized training data, called when the training data changes */
+  inline void ClearDataCache(void) {
+    hist_cache.Clear();
+  }
+
  protected:
+  /*! \brief maximum number of rows in a tile of PredictBatch */
+  static const int kTileRow = 64;
+  /*! \brief maximum size of the dense feature vectors of a tile of PredictBatch */
+  static const size_t kTileBytes = 1 << 20;
+  /*! \brief number of boosters used in prediction, a refresh pass only uses the ones refreshed so far */
+  inline size_t NumPredBooster(void) const {
+    return process_type == kRefresh ? num_refreshed : boosters.size();
+  }
+  /*! \brief pack the tree boosters in [flat.NumTree(), nbooster) into the inference layout */
+  inline void SyncFlat(size_t nbooster) {
+    for (size_t i = flat.NumTree(); i < nbooster; ++i) {
+      const RegTree *tree = boosters[i]->GetTree();
+      if (tree == NULL) return;
+      flat.AddTree(*tree);
+    }
+  }
+  /*!
+   * \brief bring the quick scorer to the boosters in [0, nbooster), called by unbuffered
+   *        prediction only, so training rounds with buffered predictions never pay for Finalize
+   * \return whether the quick scorer can be used, it needs small single root numerical trees
+   */
+  inline bool SyncQuickScorer(size_t nbooster) {
+    if (use_quick_scorer == 0 || !quick_scorer_ok) return false;
+    if (qscorer.NumTree() > nbooster) qscorer.Clear();
+    if (qscorer.NumTree() == nbooster) return true;
+    for (size_t i = qscorer.NumTree(); i < nbooster; ++i) {
+      const RegTree *tree = boosters[i]->GetTree();
+      if (tree == NULL || !qscorer.AddTree(*tree)) {
+        quick_scorer_ok = false; qscorer.Clear();
+        return false;
+      }
+    }
+    qscorer.Finalize();
+    return true;
+  }
+  /*! \brief drop the inference layouts, they are built again from the boosters when used */
+  inline void ClearInference(void) {
+    flat.Clear(); qscorer.Clear();
+  }
   /*! \brief free space of the model */
   inline void FreeSpace(void) {
     for (size_t i = 0; i < boosters.size(); ++i) {
       delete boosters[i];
     }
     boosters.clear(); mparam.num_boosters = 0; 
+    this->ClearInference();
+    quick_scorer_ok = true;
   }  
   /*! \brief configure a booster */
   inline void ConfigBooster(IGradBooster *bst) {
     for (size_t i = 0; i < cfg.size(); ++i) {
       bst->SetParam(cfg[i].first.c_str(), cfg[i].second.c_str());
     }
+    bst->SetDataCache(&hist_cache);
+    bst->SetThreadWorkspace(&threadtemp);
   }
   /*! 
    * \brief get a booster to update 
@@ -221,6 +422,20 @@ class GBTree {
  protected:
   /*! \brief component boosters */ 
   std::vector<IGradBooster*> boosters;
+  /*! \brief inference layout of the tree boosters, holds a prefix of boosters */
+  FlatTreeEnsemble flat;
+  /*! \brief bitvector scorer of the tree boosters, holds a prefix of boosters */
+  QuickScorer qscorer;
+  /*! \brief whether to score with qscorer when the trees allow it */
+  int use_quick_scorer;
+  /*! \brief false once a tree that qscorer can not score is met */
+  bool quick_scorer_ok;
+  /*! \brief instruction set used by the block traversal of flat, see FlatTreeEnsemble::SIMDLevel */
+  int simd_level;
+  /*! \brief quantized training data shared by the tree boosters across the rounds */
+  HistIndexCache hist_cache;
+  /*! \brief per thread scratch shared by the tree boosters, one set of buffers for the whole model */
+  ThreadWorkspace threadtemp;
   /*! \brief prediction buffer */ 
   std::vector<float> pred_buffer;
   /*! \brief prediction buffer counter, record the progress so fart of the buffer */ 
@@ -228,6 +443,19 @@ class GBTree {
   // ----training fields----
   // configurations for tree
   std::vector< std::pair<std::string, std::string> > cfg;
+  /*! \brief kind of training process */
+  enum ProcessType {
+    /*! \brief add a new booster each round */
+    kDefault = 0,
+    /*! \brief keep the boosters of the loaded model, refresh one of them each round */
+    kRefresh = 1
+  };
+  /*! \brief training process, one of ProcessType */
+  int process_type;
+  /*! \brief number of boosters refreshed in the current refresh pass */
+  size_t num_refreshed;
+  /*! \brief size of prediction buffer requested by the training data */
+  int num_pbuffer;
 };
 }  // namespace gbm
 }  // namespace xgboost
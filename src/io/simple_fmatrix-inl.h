@@ -8,6 +8,7 @@
 
 #include <vector>
 #include <climits>
+#include <algorithm>
 #include "../data.h"
 #include "../utils/utils.h"
 #include "../utils/io.h"
@@ -19,6 +20,9 @@ namespace xgboost{
  */        
 class FMatrixS: public IFMatrix {
  public:
+  FMatrixS(void) {
+    this->Clear();
+  }
   /*!  \brief get number of rows */
   inline size_t NumRow(void) const {
     return row_ptr_.size() - 1;
@@ -39,6 +43,7 @@ class FMatrixS: public IFMatrix {
     for (size_t i = 0; i < findex.size(); ++i) {
       if (findex[i] < fstart || findex[i] >= fend) continue;
       row_data_.push_back(REntry(findex[i], fvalue[i]));
+      num_col_ = std::max(num_col_, static_cast<size_t>(findex[i]) + 1);
       cnt ++;
     }
     row_ptr_.push_back(row_ptr_.back() + cnt);
@@ -47,20 +52,26 @@ class FMatrixS: public IFMatrix {
   /*!  \brief get row iterator*/
   inline RowIter GetRow(size_t ridx) const {
     utils::Assert(!bst_debug || ridx < this->NumRow(), "row id exceed bound");
-    return RowIter(&row_data_[row_ptr_[ridx]]-1, &row_data_[row_ptr_[ridx+1]]-1);
+    // the rows of a matrix without entries are empty, there is no storage to point into
+    if (row_data_.size() == 0) return RowIter(NULL, NULL);
+    const REntry *data = &row_data_[0] - 1;
+    return RowIter(data + row_ptr_[ridx], data + row_ptr_[ridx+1]);
   }
  public:
-  /*!  \brief get number of colmuns */
+  /*!  \brief get number of colmuns, available without column access */
   inline size_t NumCol(void) const {
-    utils::Assert(this->HaveColAccess(), 
-                  " Can not get number of column, do not have access.");
-    return col_ptr_.size() - 1;
+    return num_col_;
   }
   /*!  \brief get col iterator*/
   inline ColIter GetSortedCol(size_t cidx) const {
     utils::Assert(!bst_debug || cidx < this->NumCol(), "col id exceed bound");
     return ColIter( &col_data_[ col_ptr_[cidx] ] - 1, &col_data_[ col_ptr_[cidx+1] ] - 1 );
   }
+  /*!  \brief get col iterator that goes backward */
+  inline ColBackIter GetReverseSortedCol(size_t cidx) const {
+    utils::Assert(!bst_debug || cidx < this->NumCol(), "col id exceed bound");
+    return ColBackIter( &col_data_[0] + col_ptr_[cidx+1], &col_data_[0] + col_ptr_[cidx] );
+  }
   /*! \brief clear the storage */
   inline void Clear(void) {
     row_ptr_.clear();
@@ -68,10 +79,22 @@ class FMatrixS: public IFMatrix {
     row_data_.clear();
     col_ptr_.clear();
     col_data_.clear();
+    num_col_ = 0;
   }
-  inline void InitData(void) {
+  /*!
+   * \brief initialize the data after all the rows are added
+   * \param col_access whether to build the sorted columns, the column copy doubles
+   *        the memory of the matrix, and is only needed by the column based tree makers
+   */
+  inline void InitData(bool col_access = true) {
+    if (!col_access) {
+      std::vector<size_t>().swap(col_ptr_);
+      std::vector<REntry>().swap(col_data_);
+      return;
+    }
+    if (this->HaveColAccess()) return;
     utils::SparseCSRMBuilder<REntry> builder(col_ptr_, col_data_);
-    builder.InitBudget(0);
+    builder.InitBudget(num_col_);
     for (size_t i = 0; i < this->NumRow(); ++i) {
       for (RowIter it = this->GetRow(i); it.Next(); ) {
         builder.AddBudget(it.findex());
@@ -115,6 +138,11 @@ class FMatrixS: public IFMatrix {
   */
   inline void LoadBinary(utils::IStream &fi) {
     FMatrixS::LoadBinary(fi, row_ptr_, row_data_);
+    num_col_ = 0;
+    for (size_t i = 0; i < row_data_.size(); ++i) {
+      num_col_ = std::max(num_col_, static_cast<size_t>(row_data_[i].findex) + 1);
+    }
+    col_ptr_.clear(); col_data_.clear();
     int col_access;                
     fi.Read(&col_access, sizeof(int));
     if (col_access != 0) {
@@ -166,6 +194,8 @@ class FMatrixS: public IFMatrix {
   std::vector<size_t> col_ptr_;
   /*! \brief column datas */
   std::vector<REntry> col_data_;
+  /*! \brief number of columns, one plus the largest feature index */
+  size_t num_col_;
 };
 
 }  // namespace xgboost
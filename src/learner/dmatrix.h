@@ -8,9 +8,12 @@
  *        The data should contain each data instance in each line.
  *		  The format of line data is as below:
  *        label <nonzero feature dimension> [feature index:feature value]+
+ *     An optional file fname.root gives the root of each instance, one id per line,
+ *     instances of different roots are grown as separate subtrees of each tree.
  */
 #include <cstdio>
 #include <vector>
+#include <string>
 #include "../data.h"
 #include "../utils/utils.h"
 #include "../utils/io.h"
@@ -27,6 +30,8 @@ struct DMatrix {
   FMatrixS data;
   /*! \brief label of each instance */
   std::vector<float> labels;
+  /*! \brief pre-partitioned root of each instance, empty means every instance starts from root 0 */
+  std::vector<unsigned> root_index;
  public:
   /*! \brief default constructor */
   DMatrix(void) {}
@@ -39,8 +44,9 @@ struct DMatrix {
   * \brief load from text file 
   * \param fname name of text data
   * \param silent whether print information or not
+  * \param col_access whether to build the column access of the data
   */            
-  inline void LoadText(const char* fname, bool silent = false) {
+  inline void LoadText(const char* fname, bool silent = false, bool col_access = true) {
     data.Clear();
     FILE* file = utils::FopenCheck(fname, "r");
     float label; bool init = true;
@@ -65,8 +71,8 @@ struct DMatrix {
 
     labels.push_back(label);
     data.AddRow(findex, fvalue);
-    // initialize column support as well
-    data.InitData();
+    // initialize column support if needed
+    data.InitData(col_access);
 
     if (!silent) {
       printf("%ux%u matrix with %lu entries is loaded from %s\n", 
@@ -78,9 +84,10 @@ struct DMatrix {
   * \brief load from binary file 
   * \param fname name of binary data
   * \param silent whether print information or not
+  * \param col_access whether to build the column access of the data
   * \return whether loading is success
   */
-  inline bool LoadBinary(const char* fname, bool silent = false) {
+  inline bool LoadBinary(const char* fname, bool silent = false, bool col_access = true) {
     FILE *fp = fopen64(fname, "rb");
     if (fp == NULL) return false;                
     utils::FileStream fs(fp);
@@ -88,8 +95,8 @@ struct DMatrix {
     labels.resize(data.NumRow());
     utils::Assert(fs.Read(&labels[0], sizeof(float)*data.NumRow()) != 0, "DMatrix LoadBinary");
     fs.Close();
-    // initialize column support as well
-    data.InitData();
+    // initialize column support if needed, reuses the columns stored in the buffer
+    data.InitData(col_access);
 
     if (!silent) {
       printf("%ux%u matrix with %lu entries is loaded from %s\n", 
@@ -103,9 +110,6 @@ struct DMatrix {
   * \param silent whether print information or not
   */
   inline void SaveBinary(const char* fname, bool silent = false) {
-    // initialize column support as well
-    data.InitData();
-
     utils::FileStream fs(utils::FopenCheck(fname, "wb"));
     data.SaveBinary(fs);
     fs.Write(&labels[0], sizeof(float)*data.NumRow());
@@ -123,18 +127,48 @@ struct DMatrix {
   * \param fname name of binary data
   * \param silent whether print information or not
   * \param savebuffer whether do save binary buffer if it is text
+  * \param col_access whether to build the column access of the data
   */
-  inline void CacheLoad(const char *fname, bool silent = false, bool savebuffer = true) {
+  inline void CacheLoad(const char *fname, bool silent = false, bool savebuffer = true,
+                        bool col_access = true) {
     int len = strlen(fname);
+    char bname[1024];
     if (len > 8 && !strcmp(fname + len - 7, ".buffer")) {
-      this->LoadBinary(fname, silent); return;
+      this->LoadBinary(fname, silent, col_access);
+      // the root file sits next to the text data the buffer is made from
+      strncpy(bname, fname, len - 7); bname[len - 7] = '\0';
+      this->LoadRootIndex(bname, silent);
+      return;
     }
-    char bname[1024];
     sprintf(bname, "%s.buffer", fname);
-    if (!this->LoadBinary(bname, silent)) {
-      this->LoadText(fname, silent);
+    if (!this->LoadBinary(bname, silent, col_access)) {
+      this->LoadText(fname, silent, col_access);
       if (savebuffer) this->SaveBinary(bname, silent);
     }
+    this->LoadRootIndex(fname, silent);
+  }
+  /*!
+   * \brief load the root of each instance from fname.root if the file exists
+   * \param fname name of the data
+   * \param silent whether print information or not
+   */
+  inline void LoadRootIndex(const char *fname, bool silent = false) {
+    root_index.clear();
+    const std::string rname = std::string(fname) + ".root";
+    FILE *fi = fopen64(rname.c_str(), "r");
+    if (fi == NULL) return;
+    unsigned gid;
+    while (fscanf(fi, "%u", &gid) == 1) {
+      root_index.push_back(gid);
+    }
+    fclose(fi);
+    utils::Check(root_index.size() == this->Size(),
+                 "%s: number of roots %lu does not match number of instances %lu", rname.c_str(),
+                 static_cast<unsigned long>(root_index.size()), static_cast<unsigned long>(this->Size()));
+    if (!silent) {
+      printf("root index of %lu instances is loaded from %s\n",
+             static_cast<unsigned long>(root_index.size()), rname.c_str());
+    }
   }
 private:
   /*! \brief update num_feature info */
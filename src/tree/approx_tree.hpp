@@ -0,0 +1,428 @@
+#ifndef XGBOOST_TREE_APPROX_TREE_HPP
+#define XGBOOST_TREE_APPROX_TREE_HPP
+/*!
+ * \file approx_tree.hpp
+ * \brief approximate regression tree constructor, the split candidates are
+ *        re-proposed at every level with a weighted quantile sketch of the
+ *        instances that reach each node, and the splits are enumerated over
+ *        the gradient histograms built on these candidates;
+ *        the rows of each node are kept in a contiguous range of a row index array,
+ *        so only the rows of the data are read, column access is not needed
+ */
+#include <vector>
+#include <algorithm>
+#include "tree_model.h"
+#include "hist_util.h"
+#include "row_set.h"
+#include "col_sample.h"
+#include "thread_workspace.h"
+#include "../utils/omp.h"
+
+namespace xgboost {
+namespace gbm {
+/*! \brief approximate tree updater, grows the tree level by level */
+class ApproxTreeUpdater {
+ private:
+  // training parameter
+  const TreeParamTrain &param;
+  // parameters, reference
+  RegTree &tree;
+  std::vector<float> &grad;
+  std::vector<float> &hess;
+  const IFMatrix &smat;
+  const std::vector<unsigned> &group_id;
+  // rows used to build the tree, in ascending order
+  const std::vector<bst_uint> &active_rows;
+  // features allowed in the split search
+  ColumnSampler &colsampler;
+  // per thread scratch of the trainer
+  ThreadWorkspace &threadtemp;
+ public:
+  ApproxTreeUpdater(const TreeParamTrain &pparam,
+                    RegTree &ptree,
+                    std::vector<float> &pgrad,
+                    std::vector<float> &phess,
+                    const IFMatrix &psmat,
+                    const std::vector<unsigned> &pgroup_id,
+                    const std::vector<bst_uint> &pactive_rows,
+                    ColumnSampler &pcolsampler,
+                    ThreadWorkspace &pthreadtemp):
+      param(pparam), tree(ptree), grad(pgrad), hess(phess),
+      smat(psmat), group_id(pgroup_id), active_rows(pactive_rows),
+      colsampler(pcolsampler), threadtemp(pthreadtemp) {
+  }
+  /*!
+   * \brief grow the tree level by level, each level proposes the candidates and
+   *        builds the histograms of all expanding nodes
+   * \param num_pruned number of nodes pruned during construction
+   * \return maximum depth of the tree
+   */
+  inline int DoBoost(int &num_pruned) {
+    num_pruned = 0;
+    this->InitData();
+    this->InitNewNode();
+    for (int depth = 0; depth < param.max_depth; ++depth) {
+      this->ProposeCut(depth);
+      this->BuildHist();
+      this->FindSplit(depth);
+      this->ResetPosition();
+      this->UpdateQueueExpand();
+      if (qexpand.size() == 0) break;
+      this->InitNewNode();
+    }
+    // set all the rest expanding nodes to leaf, with the statistics of a leaf made in FindSplit
+    for (size_t i = 0; i < qexpand.size(); ++i) {
+      const int nid = qexpand[i];
+      const NodeEntry &e = snode[nid];
+      tree.stat(nid).loss_chg = e.best.loss_chg;
+      tree.stat(nid).sum_hess = static_cast<float>(e.stats.sum_hess);
+      tree.stat(nid).base_weight = e.weight;
+      tree.stat(nid).leaf_child_cnt = 0;
+      tree[nid].set_leaf(e.weight * param.learning_rate);
+    }
+    return tree.MaxDepth();
+  }
+
+ private:
+  // statistics of a node that is being expanded
+  struct NodeEntry {
+    /*! \brief statics for node entry */
+    GradStats stats;
+    /*! \brief loss of this node, without split */
+    float root_gain;
+    /*! \brief weight calculated related to current data */
+    float weight;
+    /*! \brief number of instances in the node */
+    bst_uint num_row;
+    /*! \brief current best solution */
+    SplitEntry best;
+    NodeEntry(void) : root_gain(0.0f), weight(0.0f), num_row(0) {}
+  };
+  // initialize temp data structure
+  inline void InitData(void) {
+    const unsigned ndata = static_cast<unsigned>(grad.size());
+    utils::Assert(group_id.size() == 0 || group_id.size() == ndata,
+                  "root index must be either empty or have same size as the data");
+    // only the sampled rows enter the row sets, the other ones are never visited
+    row_set.Init(active_rows, tree.param.num_roots, group_id);
+    utils::Assert(threadtemp.Size() >= static_cast<size_t>(omp_get_max_threads()),
+                  "ApproxTreeUpdater: not enough thread scratch");
+    ssketch.resize(omp_get_max_threads());
+    // a summary finer than 1 / sketch_eps entries carries no extra information
+    max_cut = std::min(param.max_bin, static_cast<int>(1.0f / param.sketch_eps) + 1);
+    max_cut = std::max(max_cut, 2);
+    snode.clear();
+    qexpand.clear();
+    for (int i = 0; i < tree.param.num_roots; ++i) {
+      qexpand.push_back(i);
+    }
+  }
+  // initialize the statistics of the nodes in qexpand by summing the instances in them
+  inline void InitNewNode(void) {
+    const int nthread = omp_get_max_threads();
+    for (int tid = 0; tid < nthread; ++tid) {
+      threadtemp[tid].stats.resize(qexpand.size());
+      std::fill(threadtemp[tid].stats.begin(), threadtemp[tid].stats.end(), GradStats());
+    }
+    std::vector<RowSetCollection::Block> blocks;
+    row_set.MakeBlocks(qexpand, blocks);
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int k = 0; k < static_cast<int>(blocks.size()); ++k) {
+      const RowSetCollection::Block &b = blocks[k];
+      GradStats &s = threadtemp[omp_get_thread_num()].stats[b.slot];
+      for (size_t i = b.begin; i < b.end; ++i) {
+        const bst_uint ridx = row_set.row_index[i];
+        s.Add(grad[ridx], hess[ridx]);
+      }
+    }
+    snode.resize(tree.param.num_nodes, NodeEntry());
+    for (size_t j = 0; j < qexpand.size(); ++j) {
+      NodeEntry &e = snode[qexpand[j]];
+      e.stats.Clear();
+      for (int tid = 0; tid < nthread; ++tid) {
+        e.stats.Add(threadtemp[tid].stats[j]);
+      }
+      e.num_row = static_cast<bst_uint>(row_set[qexpand[j]].size());
+      e.root_gain = static_cast<float>(e.stats.CalcGain(param));
+      e.weight = static_cast<float>(e.stats.CalcWeight(param));
+      e.best = SplitEntry();
+    }
+  }
+  /*!
+   * \brief propose the cuts of every expanding node, from the hessian weighted sketch of its own instances,
+   *        only the features of the level get cuts; as in HistCutMatrix::Init, each thread sketches
+   *        a range of the rows of the node and the summaries are merged, the features are taken in blocks
+   *        so that the sketches of all the threads stay within HistCutMatrix::kSketchBytes
+   */
+  inline void ProposeCut(int depth) {
+    const unsigned nfeat = static_cast<unsigned>(smat.NumCol());
+    const std::vector<unsigned> &fset = colsampler.LevelFeatures(depth);
+    const int nlevel = static_cast<int>(fset.size());
+    const size_t max_thread = ssketch.size();
+    // position of each feature in fset, -1 for the features not used by the level
+    std::vector<int> fpos(nfeat, -1);
+    for (int k = 0; k < nlevel; ++k) {
+      fpos[fset[k]] = k;
+    }
+    std::vector< std::vector<bst_float> > fcut;
+    ncut.resize(qexpand.size());
+    for (size_t j = 0; j < qexpand.size(); ++j) {
+      const RowSetCollection::Elem &e = row_set[qexpand[j]];
+      fcut.clear(); fcut.resize(nfeat);
+      HistCutMatrix::Sketch probe;
+      probe.Init(std::max((e.size() + max_thread - 1) / max_thread, static_cast<size_t>(1)), param.sketch_eps);
+      const int kstep = static_cast<int>(std::max(static_cast<size_t>(1),
+          std::min(static_cast<size_t>(nlevel), HistCutMatrix::kSketchBytes / (max_thread * probe.MaxBytes()))));
+      for (int kbegin = 0; kbegin < nlevel; kbegin += kstep) {
+        const int kend = std::min(nlevel, kbegin + kstep);
+        // the sketches of the previous block give their memory back
+        for (size_t tid = 0; tid < max_thread; ++tid) {
+          ssketch[tid].clear();
+        }
+        #pragma omp parallel
+        {
+          const int tid = omp_get_thread_num();
+          const size_t nthread = static_cast<size_t>(omp_get_num_threads());
+          const size_t step = (e.size() + nthread - 1) / nthread;
+          const size_t begin = std::min(e.begin + step * tid, e.end);
+          const size_t end = std::min(begin + step, e.end);
+          std::vector<HistCutMatrix::Sketch> &sketch = ssketch[tid];
+          if (begin != end) {
+            sketch.resize(kend - kbegin);
+            for (int k = kbegin; k < kend; ++k) {
+              sketch[k - kbegin].Init(end - begin, param.sketch_eps);
+            }
+          }
+          for (size_t i = begin; i < end; ++i) {
+            const bst_uint ridx = row_set.row_index[i];
+            for (IFMatrix::RowIter it = smat.GetRow(ridx); it.Next();) {
+              const int k = fpos[it.findex()];
+              if (k < kbegin || k >= kend) continue;
+              sketch[k - kbegin].Push(it.fvalue(), hess[ridx]);
+            }
+          }
+        }
+        #pragma omp parallel for schedule(dynamic, 1)
+        for (int k = kbegin; k < kend; ++k) {
+          HistCutMatrix::Sketch::Summary summary, part, temp;
+          for (size_t tid = 0; tid < max_thread; ++tid) {
+            if (ssketch[tid].size() == 0) continue;
+            ssketch[tid][k - kbegin].GetSummary(part);
+            temp.SetCombine(summary, part);
+            summary.data.swap(temp.data);
+          }
+          HistCutMatrix::MakeCut(summary, max_cut, fcut[fset[k]]);
+        }
+      }
+      ncut[j].Set(fcut);
+    }
+  }
+  /*!
+   * \brief build the histograms of all the nodes in qexpand on their own cuts, from the rows of each node;
+   *        nodes holding at most the share of one thread are built by one thread each, the rows of
+   *        a larger node are shared by the threads, each thread builds a partial histogram and they are summed
+   */
+  inline void BuildHist(void) {
+    const size_t nthread = static_cast<size_t>(omp_get_max_threads());
+    std::vector<int> qnode, qrow;
+    size_t total_row = 0;
+    hist.resize(qexpand.size());
+    for (size_t j = 0; j < qexpand.size(); ++j) {
+      hist[j].resize(ncut[j].NumBin());
+      std::fill(hist[j].begin(), hist[j].end(), GradStats());
+      total_row += row_set[qexpand[j]].size();
+    }
+    for (size_t j = 0; j < qexpand.size(); ++j) {
+      // a node whose rows give no cut has nothing to build
+      if (hist[j].size() == 0) continue;
+      if (nthread == 1 || row_set[qexpand[j]].size() * nthread <= total_row) {
+        qnode.push_back(static_cast<int>(j));
+      } else {
+        qrow.push_back(static_cast<int>(j));
+      }
+    }
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int k = 0; k < static_cast<int>(qnode.size()); ++k) {
+      const int j = qnode[k];
+      const RowSetCollection::Elem &e = row_set[qexpand[j]];
+      this->BuildHistRange(e.begin, e.end, ncut[j], &hist[j][0]);
+    }
+    for (size_t k = 0; k < qrow.size(); ++k) {
+      const int j = qrow[k];
+      const RowSetCollection::Elem &e = row_set[qexpand[j]];
+      const size_t nbin = hist[j].size();
+      GradStats *h = &hist[j][0];
+      #pragma omp parallel
+      {
+        const int tid = omp_get_thread_num();
+        const size_t nthread = static_cast<size_t>(omp_get_num_threads());
+        const size_t step = (e.size() + nthread - 1) / nthread;
+        const size_t begin = std::min(e.begin + step * tid, e.end);
+        const size_t end = std::min(begin + step, e.end);
+        GradStats *out = h;
+        if (tid != 0) {
+          std::vector< GradStats, utils::AlignedAllocator<GradStats> > &th = threadtemp[tid].hist;
+          th.resize(nbin);
+          std::fill(th.begin(), th.end(), GradStats());
+          out = &th[0];
+        }
+        this->BuildHistRange(begin, end, ncut[j], out);
+        #pragma omp barrier
+        #pragma omp for schedule(static)
+        for (long i = 0; i < static_cast<long>(nbin); ++i) {
+          for (size_t t = 1; t < nthread; ++t) {
+            h[i].Add(threadtemp[t].hist[i]);
+          }
+        }
+      }
+    }
+  }
+  // add the rows in [begin, end) of the row index array to histogram h, whose bins are given by cut
+  inline void BuildHistRange(size_t begin, size_t end, const HistCutMatrix &cut, GradStats *h) const {
+    for (size_t i = begin; i < end; ++i) {
+      const bst_uint ridx = row_set.row_index[i];
+      const double g = grad[ridx], hs = hess[ridx];
+      for (IFMatrix::RowIter it = smat.GetRow(ridx); it.Next();) {
+        const unsigned fid = it.findex();
+        // the features out of the level, and the ones whose instances all have zero hessian, have no cut
+        if (cut.row_ptr[fid] == cut.row_ptr[fid + 1]) continue;
+        h[cut.row_ptr[fid] + cut.GetBin(fid, it.fvalue())].Add(g, hs);
+      }
+    }
+  }
+  /*!
+   * \brief enumerate the split points of one feature on the histogram of a node,
+   *        the histogram only holds the present values, the missing ones are the rest of the node
+   */
+  inline void EnumerateSplit(int nid, unsigned fid, const HistCutMatrix &cut,
+                             const GradStats *h, SplitEntry &best) {
+    const NodeEntry &e = snode[nid];
+    const unsigned begin = cut.row_ptr[fid];
+    const unsigned end = cut.row_ptr[fid + 1];
+    if (begin == end) return;
+    GradStats s, c;
+    // default_direction, 0: learn, 1: left, 2: right
+    if (param.default_direction != 1) {
+      // bins up to i go to left, the rest and the missing values go to right
+      for (unsigned i = begin; i < end; ++i) {
+        s.Add(h[i]);
+        if (s.sum_hess < param.min_child_weight) continue;
+        c.SetSubstract(e.stats, s);
+        if (c.sum_hess < param.min_child_weight) continue;
+        const double loss_chg = s.CalcGain(param) + c.CalcGain(param) - e.root_gain;
+        best.Update(static_cast<float>(loss_chg), fid, cut.cut[i], false);
+      }
+    }
+    if (param.default_direction != 2) {
+      // bins from i go to right, the rest and the missing values go to left
+      s.Clear();
+      for (unsigned i = end - 1; i > begin; --i) {
+        s.Add(h[i]);
+        if (s.sum_hess < param.min_child_weight) continue;
+        c.SetSubstract(e.stats, s);
+        if (c.sum_hess < param.min_child_weight) continue;
+        const double loss_chg = s.CalcGain(param) + c.CalcGain(param) - e.root_gain;
+        best.Update(static_cast<float>(loss_chg), fid, cut.cut[i - 1], true);
+      }
+    }
+  }
+  // find splits for all the nodes in qexpand from the histograms
+  inline void FindSplit(int depth) {
+    const std::vector<unsigned> &fset = colsampler.LevelFeatures(depth);
+    const int nthread = omp_get_max_threads();
+    sbest.resize(nthread);
+    for (int tid = 0; tid < nthread; ++tid) {
+      sbest[tid].resize(qexpand.size());
+      std::fill(sbest[tid].begin(), sbest[tid].end(), SplitEntry());
+    }
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int k = 0; k < static_cast<int>(fset.size()); ++k) {
+      const unsigned fid = fset[k];
+      std::vector<SplitEntry> &best = sbest[omp_get_thread_num()];
+      for (size_t j = 0; j < qexpand.size(); ++j) {
+        if (hist[j].size() == 0) continue;
+        this->EnumerateSplit(qexpand[j], fid, ncut[j], &hist[j][0], best[j]);
+      }
+    }
+    for (size_t j = 0; j < qexpand.size(); ++j) {
+      const int nid = qexpand[j];
+      NodeEntry &e = snode[nid];
+      for (int tid = 0; tid < nthread; ++tid) {
+        e.best.Update(sbest[tid][j]);
+      }
+      tree.stat(nid).loss_chg = e.best.loss_chg;
+      tree.stat(nid).sum_hess = static_cast<float>(e.stats.sum_hess);
+      tree.stat(nid).base_weight = e.weight;
+      tree.stat(nid).leaf_child_cnt = 0;
+      // min_split_loss is applied by the pruner after the tree is grown
+      if (e.best.loss_chg > rt_eps) {
+        tree.AddChilds(nid);
+        tree[nid].set_split(e.best.split_index(), e.best.split_value, e.best.default_left());
+      } else {
+        tree[nid].set_leaf(e.weight * param.learning_rate);
+      }
+    }
+  }
+  // whether a row of a split node goes to left, the value of the split feature is looked up in the row,
+  // a row without it goes to the default child
+  struct SplitGoLeft {
+    const IFMatrix &smat;
+    const RegTree &tree;
+    const std::vector<int> &nodes;
+    SplitGoLeft(const IFMatrix &smat, const RegTree &tree, const std::vector<int> &nodes)
+        : smat(smat), tree(tree), nodes(nodes) {}
+    inline bool operator()(int j, bst_uint ridx) const {
+      const RegTree::Node &n = tree[nodes[j]];
+      const unsigned fid = n.split_index();
+      for (IFMatrix::RowIter it = smat.GetRow(ridx); it.Next();) {
+        if (it.findex() == fid) return it.fvalue() < n.split_cond();
+      }
+      return n.default_left();
+    }
+  };
+  // move the instances of the split nodes in qexpand to the children
+  inline void ResetPosition(void) {
+    std::vector<int> nodes, left, right;
+    for (size_t j = 0; j < qexpand.size(); ++j) {
+      const int nid = qexpand[j];
+      if (tree[nid].is_leaf()) continue;
+      nodes.push_back(nid);
+      left.push_back(tree[nid].cleft());
+      right.push_back(tree[nid].cright());
+    }
+    row_set.Partition(nodes, left, right, SplitGoLeft(smat, tree, nodes), threadtemp);
+  }
+  // collect the new nodes to be expanded
+  inline void UpdateQueueExpand(void) {
+    std::vector<int> newnodes;
+    for (size_t j = 0; j < qexpand.size(); ++j) {
+      const int nid = qexpand[j];
+      if (!tree[nid].is_leaf()) {
+        newnodes.push_back(tree[nid].cleft());
+        newnodes.push_back(tree[nid].cright());
+      }
+    }
+    qexpand = newnodes;
+  }
+
+ private:
+  /*! \brief maximum number of cuts of a feature in one node */
+  int max_cut;
+  /*! \brief rows of each node */
+  RowSetCollection row_set;
+  /*! \brief statistics of each node */
+  std::vector<NodeEntry> snode;
+  /*! \brief cuts of the expanding nodes, indexed by the position in qexpand */
+  std::vector<HistCutMatrix> ncut;
+  /*! \brief histograms of the expanding nodes, indexed by the position in qexpand */
+  std::vector< std::vector<GradStats> > hist;
+  /*! \brief per thread sketches of the expanding nodes */
+  std::vector< std::vector<HistCutMatrix::Sketch> > ssketch;
+  /*! \brief per thread best split of the expanding nodes */
+  std::vector< std::vector<SplitEntry> > sbest;
+  /*! \brief queue of nodes to be expanded */
+  std::vector<int> qexpand;
+};
+}  // namespace gbm
+}  // namespace xgboost
+#endif
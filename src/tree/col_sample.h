@@ -0,0 +1,95 @@
+#ifndef XGBOOST_TREE_COL_SAMPLE_H
+#define XGBOOST_TREE_COL_SAMPLE_H
+/*!
+ * \file col_sample.h
+ * \brief features allowed in the split search of a tree, the features passed by
+ *        the feature constrain are sampled once per tree and again per depth,
+ *        the tree makers only scan the features of the depth of a node
+ */
+#include <vector>
+#include <algorithm>
+#include "../data.h"
+#include "../utils/utils.h"
+#include "../utils/fmap.h"
+#include "../utils/random.h"
+
+namespace xgboost {
+namespace gbm {
+/*! \brief sampler of the features used by a tree and by each of its depths */
+class ColumnSampler {
+ public:
+  /*!
+   * \brief draw the features of a new tree
+   * \param nfeat number of features in the data
+   * \param constrain feature constrain, banned features are never drawn
+   * \param colsample_bytree fraction of the allowed features used by the tree
+   * \param colsample_bylevel fraction of the features of the tree used by each depth
+   * \param seed seed of the sampler
+   */
+  inline void InitTree(unsigned nfeat, const utils::FeatConstrain &constrain,
+                       float colsample_bytree, float colsample_bylevel, uint32_t seed) {
+    utils::Check(colsample_bytree > 0.0f && colsample_bytree <= 1.0f,
+                 "colsample_bytree must be in (0, 1]");
+    utils::Check(colsample_bylevel > 0.0f && colsample_bylevel <= 1.0f,
+                 "colsample_bylevel must be in (0, 1]");
+    num_feature_ = nfeat;
+    bylevel_ = colsample_bylevel;
+    rnd_.Seed(seed);
+    std::vector<unsigned> allowed;
+    for (unsigned fid = 0; fid < nfeat; ++fid) {
+      if (constrain.NotBanned(fid)) allowed.push_back(fid);
+    }
+    this->Sample(allowed, colsample_bytree, tree_feat_);
+    level_feat_.clear();
+  }
+  /*! \return whether the tree uses every feature of the data */
+  inline bool AllFeatures(void) const {
+    return tree_feat_.size() == num_feature_;
+  }
+  /*! \return features of the tree, in ascending order */
+  inline const std::vector<unsigned> &TreeFeatures(void) const {
+    return tree_feat_;
+  }
+  /*!
+   * \brief features of the nodes at a depth, in ascending order; a depth keeps its sample for
+   *        the whole tree, the samples are drawn in order of depth the first time a depth is
+   *        asked for, so a lossguide tree draws the same samples as a depthwise one
+   * \param depth depth of the node, 0 for a root
+   */
+  inline const std::vector<unsigned> &LevelFeatures(int depth) {
+    if (bylevel_ >= 1.0f) return tree_feat_;
+    while (level_feat_.size() <= static_cast<size_t>(depth)) {
+      level_feat_.push_back(std::vector<unsigned>());
+      this->Sample(tree_feat_, bylevel_, level_feat_.back());
+    }
+    return level_feat_[depth];
+  }
+
+ private:
+  // draw round(rate * |src|) features of src without replacement, at least one if src is not empty
+  inline void Sample(const std::vector<unsigned> &src, float rate, std::vector<unsigned> &out) {
+    out = src;
+    if (rate >= 1.0f || out.size() == 0) return;
+    const size_t n = std::max(static_cast<size_t>(rate * out.size() + 0.5f), static_cast<size_t>(1));
+    // partial Fisher-Yates shuffle
+    for (size_t i = 0; i < n; ++i) {
+      const size_t j = i + static_cast<size_t>(rnd_.NextUInt64() % (out.size() - i));
+      std::swap(out[i], out[j]);
+    }
+    out.resize(n);
+    std::sort(out.begin(), out.end());
+  }
+  /*! \brief number of features in the data */
+  unsigned num_feature_;
+  /*! \brief fraction of the features of the tree used by each depth */
+  float bylevel_;
+  /*! \brief generator of the sampler */
+  random::XorShift rnd_;
+  /*! \brief features of the tree */
+  std::vector<unsigned> tree_feat_;
+  /*! \brief features of each depth drawn so far */
+  std::vector< std::vector<unsigned> > level_feat_;
+};
+}  // namespace gbm
+}  // namespace xgboost
+#endif
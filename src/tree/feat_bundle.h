@@ -0,0 +1,141 @@
+#ifndef XGBOOST_TREE_FEAT_BUNDLE_H
+#define XGBOOST_TREE_FEAT_BUNDLE_H
+/*!
+ * \file feat_bundle.h
+ * \brief exclusive feature bundling: features that are (almost) never present in the same row,
+ *        such as the one-hot columns of a categorical variable, are grouped into one bundle,
+ *        a row then holds at most one entry of each bundle
+ */
+#include <vector>
+#include <algorithm>
+#include "../data.h"
+#include "../utils/utils.h"
+#include "../utils/random.h"
+
+namespace xgboost {
+namespace gbm {
+/*! \brief greedy grouping of the features into bundles of mutually exclusive features */
+class FeatureBundler {
+ public:
+  /*!
+   * \brief group the features of fmat into bundles, only the rows are read;
+   *        the features are visited by decreasing number of entries, each one joins the
+   *        first recent bundle it conflicts with in at most max_conflict_rate * nrow rows
+   *        and whose codes can hold its bins; a bundle spends one code on the empty slot,
+   *        unless it is a single feature present in every row
+   * \param fmat feature matrix
+   * \param nrow number of rows in fmat
+   * \param nfeat number of features, entries with larger feature index are ignored
+   * \param feat_nbin number of bins of each feature
+   * \param max_code number of codes of a bundle
+   * \param max_conflict_rate fraction of the rows in which the features of a bundle may collide
+   * \param max_bundle the grouping is given up once more than max_bundle bundles are needed
+   * \param feat2bundle output, bundle of each feature
+   * \return number of bundles, 0 if the grouping is given up, also when a feature has too many bins
+   */
+  inline static unsigned Find(const IFMatrix &fmat, size_t nrow, unsigned nfeat,
+                              const std::vector<unsigned> &feat_nbin, unsigned max_code,
+                              float max_conflict_rate, size_t max_bundle,
+                              std::vector<unsigned> &feat2bundle) {
+    utils::Check(max_conflict_rate >= 0.0f && max_conflict_rate < 1.0f,
+                 "max_conflict_rate must be in [0, 1)");
+    // rows of each feature
+    std::vector<size_t> feat_ptr(nfeat + 1, 0);
+    for (size_t i = 0; i < nrow; ++i) {
+      for (IFMatrix::RowIter it = fmat.GetRow(static_cast<bst_uint>(i)); it.Next();) {
+        if (it.findex() < nfeat) ++feat_ptr[it.findex() + 1];
+      }
+    }
+    for (unsigned fid = 0; fid < nfeat; ++fid) {
+      feat_ptr[fid + 1] += feat_ptr[fid];
+    }
+    std::vector<bst_uint> feat_row(feat_ptr.back());
+    {
+      std::vector<size_t> pos(feat_ptr.begin(), feat_ptr.end() - 1);
+      for (size_t i = 0; i < nrow; ++i) {
+        for (IFMatrix::RowIter it = fmat.GetRow(static_cast<bst_uint>(i)); it.Next();) {
+          if (it.findex() < nfeat) feat_row[pos[it.findex()]++] = static_cast<bst_uint>(i);
+        }
+      }
+    }
+    std::vector<unsigned> order(nfeat);
+    for (unsigned fid = 0; fid < nfeat; ++fid) order[fid] = fid;
+    std::stable_sort(order.begin(), order.end(), MoreEntry(feat_ptr));
+    const size_t max_conflict = static_cast<size_t>(max_conflict_rate * nrow);
+    const size_t nword = (nrow + 63) / 64;
+    // rows taken by each bundle that still accepts features, as a bit set
+    std::vector< std::vector<uint64_t> > mark;
+    std::vector<unsigned> mark_bundle;
+    std::vector<size_t> conflict;
+    // codes taken by each bundle that still accepts features, including the empty code
+    std::vector<unsigned> ncode;
+    unsigned nbundle = 0;
+    feat2bundle.resize(nfeat);
+    for (size_t k = 0; k < order.size(); ++k) {
+      const unsigned fid = order[k];
+      const bst_uint *rbegin = feat_row.size() == 0 ? NULL : &feat_row[0] + feat_ptr[fid];
+      const size_t nent = feat_ptr[fid + 1] - feat_ptr[fid];
+      if (nent == 0 && nbundle != 0) {
+        // a feature without entries never collides, it goes to any bundle
+        feat2bundle[fid] = 0; continue;
+      }
+      // a feature present in most rows can not share its bundle without many conflicts
+      int best = -1;
+      if (nent * 2 <= nrow) {
+        if (feat_nbin[fid] + 1 > max_code) return 0;
+        const size_t ntry = std::min(mark.size(), static_cast<size_t>(kMaxTry));
+        for (size_t t = 0; t < ntry && best < 0; ++t) {
+          const size_t b = mark.size() - 1 - t;
+          if (ncode[b] + feat_nbin[fid] > max_code) continue;
+          size_t cnt = conflict[b];
+          for (size_t i = 0; i < nent && cnt <= max_conflict; ++i) {
+            cnt += (mark[b][rbegin[i] >> 6] >> (rbegin[i] & 63)) & 1;
+          }
+          if (cnt <= max_conflict) {
+            best = static_cast<int>(b); conflict[b] = cnt;
+          }
+        }
+        if (best < 0) {
+          mark.push_back(std::vector<uint64_t>(nword, 0));
+          mark_bundle.push_back(nbundle++);
+          conflict.push_back(0);
+          ncode.push_back(1);
+          best = static_cast<int>(mark.size() - 1);
+        }
+        ncode[best] += feat_nbin[fid];
+        for (size_t i = 0; i < nent; ++i) {
+          mark[best][rbegin[i] >> 6] |= static_cast<uint64_t>(1) << (rbegin[i] & 63);
+        }
+        feat2bundle[fid] = mark_bundle[best];
+      } else {
+        if (feat_nbin[fid] + (CountRow(rbegin, nent) == nrow ? 0 : 1) > max_code) return 0;
+        feat2bundle[fid] = nbundle++;
+      }
+      if (nbundle > max_bundle) return 0;
+    }
+    return nbundle;
+  }
+
+ private:
+  /*! \brief number of most recent bundles a feature tries to join */
+  static const int kMaxTry = 64;
+  // number of distinct rows in the ascending row list of a feature
+  inline static size_t CountRow(const bst_uint *rows, size_t nent) {
+    size_t cnt = 0;
+    for (size_t i = 0; i < nent; ++i) {
+      if (i == 0 || rows[i] != rows[i - 1]) ++cnt;
+    }
+    return cnt;
+  }
+  // order the features by decreasing number of entries
+  struct MoreEntry {
+    const std::vector<size_t> &feat_ptr;
+    explicit MoreEntry(const std::vector<size_t> &feat_ptr) : feat_ptr(feat_ptr) {}
+    inline bool operator()(unsigned a, unsigned b) const {
+      return feat_ptr[a + 1] - feat_ptr[a] > feat_ptr[b + 1] - feat_ptr[b];
+    }
+  };
+};
+}  // namespace gbm
+}  // namespace xgboost
+#endif
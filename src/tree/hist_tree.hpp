@@ -0,0 +1,917 @@
+#ifndef XGBOOST_TREE_HIST_TREE_HPP
+#define XGBOOST_TREE_HIST_TREE_HPP
+/*!
+ * \file hist_tree.hpp
+ * \brief histogram based regression tree constructor,
+ *        features are quantized into at most 256 bins once per data matrix,
+ *        and the splits are enumerated over the gradient histograms of each node,
+ *        only the smaller child of a split is built, its sibling is obtained by subtraction;
+ *        the rows of each node are kept in a contiguous range of a row index array,
+ *        so building the histogram of a node only streams through its own rows;
+ *        only the rows of the data are read, column access is not needed;
+ *        mutually exclusive features are bundled, so a row holds one slot per bundle;
+ *        a categorical feature is split by a set of categories, found by ordering
+ *        the categories of the node by their gradient ratio and scanning the prefixes
+ */
+#include <cmath>
+#include <vector>
+#include <queue>
+#include <algorithm>
+#include "tree_model.h"
+#include "hist_util.h"
+#include "row_set.h"
+#include "col_sample.h"
+#include "thread_workspace.h"
+#include "../utils/omp.h"
+
+namespace xgboost {
+namespace gbm {
+/*! \brief gradient pair of a row, read from the gradients of the trainer, summed in double */
+struct FloatGradient {
+  typedef GradStats Stats;
+  typedef double Value;
+  const float *grad, *hess;
+  FloatGradient(void) : grad(NULL), hess(NULL) {}
+  // use the gradients of the round as they are
+  inline void Init(const std::vector<float> &pgrad, const std::vector<float> &phess,
+                   const std::vector<bst_uint> &rows) {
+    grad = pgrad.size() == 0 ? NULL : &pgrad[0];
+    hess = phess.size() == 0 ? NULL : &phess[0];
+  }
+  inline double GradScale(void) const { return 1.0; }
+  inline double HessScale(void) const { return 1.0; }
+  inline Value Grad(bst_uint ridx) const { return grad[ridx]; }
+  inline Value Hess(bst_uint ridx) const { return hess[ridx]; }
+  // per thread histogram and node statistics
+  inline static std::vector< Stats, utils::AlignedAllocator<Stats> > &ThreadHist(TreeThreadEntry &t) {
+    return t.hist;
+  }
+  inline static std::vector< Stats, utils::AlignedAllocator<Stats> > &ThreadStats(TreeThreadEntry &t) {
+    return t.stats;
+  }
+};
+/*!
+ * \brief gradient pair of a row, read from the quantized gradients, summed in integers,
+ *        in units of GradScale() and HessScale()
+ */
+struct QuantGradient {
+  typedef QuantStats Stats;
+  typedef int Value;
+  QuantizedGradient qgrad;
+  // quantize the gradients of the round
+  inline void Init(const std::vector<float> &pgrad, const std::vector<float> &phess,
+                   const std::vector<bst_uint> &rows) {
+    qgrad.Init(pgrad, phess, rows);
+  }
+  inline double GradScale(void) const { return qgrad.grad_scale; }
+  inline double HessScale(void) const { return qgrad.hess_scale; }
+  inline Value Grad(bst_uint ridx) const { return qgrad.data[ridx].grad; }
+  inline Value Hess(bst_uint ridx) const { return qgrad.data[ridx].hess; }
+  // per thread histogram and node statistics
+  inline static std::vector< Stats, utils::AlignedAllocator<Stats> > &ThreadHist(TreeThreadEntry &t) {
+    return t.qhist;
+  }
+  inline static std::vector< Stats, utils::AlignedAllocator<Stats> > &ThreadStats(TreeThreadEntry &t) {
+    return t.qstats;
+  }
+};
+/*!
+ * \brief histogram based tree updater, grows the tree level by level,
+ *        or node by node in the order of loss change when grow_policy=lossguide
+ * \tparam TGradient gradient pair of a row, FloatGradient or QuantGradient,
+ *         the histograms are summed in its statistics type
+ */
+template<typename TGradient>
+class HistTreeUpdater {
+ private:
+  typedef typename TGradient::Stats TStats;
+  typedef typename TGradient::Value TValue;
+  // training parameter
+  const TreeParamTrain &param;
+  // parameters, reference
+  RegTree &tree;
+  std::vector<float> &grad;
+  std::vector<float> &hess;
+  const IFMatrix &smat;
+  const std::vector<unsigned> &group_id;
+  // rows used to build the tree, in ascending order
+  const std::vector<bst_uint> &active_rows;
+  // features allowed in the split search
+  ColumnSampler &colsampler;
+  // categorical features
+  const utils::FeatCategorical &fcat;
+  // per thread scratch of the trainer
+  ThreadWorkspace &threadtemp;
+  // quantized matrix of the model, kept across the rounds
+  HistIndexCache &hcache;
+ public:
+  HistTreeUpdater(const TreeParamTrain &pparam,
+                  RegTree &ptree,
+                  std::vector<float> &pgrad,
+                  std::vector<float> &phess,
+                  const IFMatrix &psmat,
+                  const std::vector<unsigned> &pgroup_id,
+                  const std::vector<bst_uint> &pactive_rows,
+                  ColumnSampler &pcolsampler,
+                  const utils::FeatCategorical &pfcat,
+                  ThreadWorkspace &pthreadtemp,
+                  HistIndexCache &phcache):
+      param(pparam), tree(ptree), grad(pgrad), hess(phess),
+      smat(psmat), group_id(pgroup_id), active_rows(pactive_rows),
+      colsampler(pcolsampler), fcat(pfcat), threadtemp(pthreadtemp), hcache(phcache) {
+  }
+  /*!
+   * \brief grow the tree
+   * \param num_pruned number of nodes pruned during construction
+   * \return maximum depth of the tree
+   */
+  inline int DoBoost(int &num_pruned) {
+    num_pruned = 0;
+    this->InitData();
+    if (param.grow_policy == 1) {
+      this->ExpandLossGuide();
+    } else {
+      this->ExpandDepthWise();
+    }
+    return tree.MaxDepth();
+  }
+
+ private:
+  // candidate node of lossguide growth, the one with largest loss change is expanded first
+  struct ExpandEntry {
+    int nid;
+    int depth;
+    float loss_chg;
+    ExpandEntry(int nid, int depth, float loss_chg)
+        : nid(nid), depth(depth), loss_chg(loss_chg) {}
+    // ties are broken by node id, so that older nodes are expanded first
+    inline bool operator<(const ExpandEntry &b) const {
+      if (loss_chg == b.loss_chg) return nid > b.nid;
+      return loss_chg < b.loss_chg;
+    }
+  };
+  // each level builds the histograms of all expanding nodes
+  inline void ExpandDepthWise(void) {
+    this->InitNewNode();
+    for (int depth = 0; depth < param.max_depth; ++depth) {
+      this->BuildHist();
+      this->FindSplit();
+      for (size_t j = 0; j < qexpand.size(); ++j) {
+        this->ApplySplit(qexpand[j], depth);
+      }
+      this->ResetPosition();
+      this->UpdateQueueExpand();
+      if (qexpand.size() == 0) break;
+      this->InitNewNode();
+    }
+    for (size_t i = 0; i < qexpand.size(); ++i) {
+      this->SetLeaf(qexpand[i]);
+    }
+  }
+  /*!
+   * \brief always split the candidate with largest loss change, until max_leaves is reached;
+   *        each root keeps its own queue and budget of leaves, so the subtrees grow independently,
+   *        and every step expands the best candidate of each root together
+   */
+  inline void ExpandLossGuide(void) {
+    const int nroot = tree.param.num_roots;
+    std::vector< std::priority_queue<ExpandEntry> > pqueue(nroot);
+    this->InitNewNode();
+    this->BuildHist();
+    this->FindSplit();
+    for (size_t j = 0; j < qexpand.size(); ++j) {
+      pqueue[qexpand[j]].push(ExpandEntry(qexpand[j], 0, tree.stat(qexpand[j]).loss_chg));
+    }
+    std::vector<int> num_leaves(nroot, 1);
+    std::vector<ExpandEntry> batch;
+    std::vector<int> batch_root;
+    while (true) {
+      batch.clear(); batch_root.clear();
+      for (int r = 0; r < nroot; ++r) {
+        while (!pqueue[r].empty()) {
+          const ExpandEntry e = pqueue[r].top(); pqueue[r].pop();
+          // max_depth <= 0 means no depth limit in lossguide growth
+          if ((param.max_leaves > 0 && num_leaves[r] >= param.max_leaves) ||
+              (param.max_depth > 0 && e.depth >= param.max_depth)) {
+            this->SetLeaf(e.nid); continue;
+          }
+          if (!this->ApplySplit(e.nid, e.depth)) continue;
+          num_leaves[r] += 1;
+          batch.push_back(e); batch_root.push_back(r);
+          break;
+        }
+      }
+      if (batch.size() == 0) break;
+      // the children of the split nodes form the expanding set of next step
+      qexpand.clear();
+      for (size_t k = 0; k < batch.size(); ++k) {
+        qexpand.push_back(batch[k].nid);
+      }
+      this->InitNode2Slot();
+      this->ResetPosition();
+      this->UpdateQueueExpand();
+      this->InitNewNode();
+      this->BuildHist();
+      this->FindSplit();
+      // qexpand holds the two children of each split node, in the order of the batch
+      for (size_t j = 0; j < qexpand.size(); ++j) {
+        const ExpandEntry &p = batch[j / 2];
+        pqueue[batch_root[j / 2]].push(ExpandEntry(qexpand[j], p.depth + 1, tree.stat(qexpand[j]).loss_chg));
+      }
+    }
+  }
+  // statistics of a node that is being expanded
+  struct NodeEntry {
+    /*! \brief statics for node entry */
+    TStats stats;
+    /*! \brief loss of this node, without split */
+    float root_gain;
+    /*! \brief weight calculated related to current data */
+    float weight;
+    /*! \brief number of instances in the node */
+    bst_uint num_row;
+    /*! \brief current best solution */
+    SplitEntry best;
+    /*! \brief categories going left in the best solution, when it is a categorical split */
+    std::vector<unsigned> cat_bits;
+    NodeEntry(void) : root_gain(0.0f), weight(0.0f), num_row(0) {}
+  };
+  // a category present in a node, ordered by the gradient ratio, ties by category
+  struct CatEntry {
+    double ratio;
+    unsigned bin;
+    CatEntry(double ratio, unsigned bin) : ratio(ratio), bin(bin) {}
+    inline bool operator<(const CatEntry &b) const {
+      if (ratio == b.ratio) return bin < b.bin;
+      return ratio < b.ratio;
+    }
+  };
+  // how the threads share the work of building the histogram of a node
+  enum BuildMode {
+    // one thread builds the whole histogram
+    kNodeParallel = 0,
+    // each thread builds a partial histogram from a block of rows, then they are summed
+    kRowParallel = 1,
+    // each thread builds the bins of a range of features from all the rows
+    kFeatParallel = 2
+  };
+  // initialize temp data structure
+  inline void InitData(void) {
+    const unsigned ndata = static_cast<unsigned>(grad.size());
+    utils::Assert(group_id.size() == 0 || group_id.size() == ndata,
+                  "root index must be either empty or have same size as the data");
+    // the sketch should be at least as fine as the bins
+    const float eps = std::min(param.sketch_eps, 1.0f / param.max_bin);
+    gmat = &hcache.Get(smat, ndata, param.max_bin, eps, hess, fcat.Flags(), param.max_cat_bins,
+                       param.enable_bundle != 0, param.max_conflict_rate);
+    // only the sampled rows enter the row sets, the other ones are never visited
+    row_set.Init(active_rows, tree.param.num_roots, group_id);
+    gpair.Init(grad, hess, active_rows);
+    gscale = gpair.GradScale(); hscale = gpair.HessScale();
+    this->InitHistIndex();
+    utils::Assert(threadtemp.Size() >= static_cast<size_t>(omp_get_max_threads()),
+                  "HistTreeUpdater: not enough thread scratch");
+    ctemp.resize(omp_get_max_threads());
+    // the bundled matrix sends the empty slots to a spare bin after the last one
+    nhist = gmat->cut.NumBin() + (gmat->IsBundled() ? 1 : 0);
+    hpool.Init(nhist);
+    snode.clear();
+    qexpand.clear();
+    for (int i = 0; i < tree.param.num_roots; ++i) {
+      qexpand.push_back(i);
+    }
+  }
+  /*!
+   * \brief select the entries of the quantized matrix used to build the histograms,
+   *        when the tree uses a subset of the features, the entries of the features of the tree
+   *        in the active rows are copied out once, so the histogram passes never scan the others;
+   *        a bundled matrix only skips the bundles holding no feature of the tree
+   */
+  inline void InitHistIndex(void) {
+    if (gmat->IsBundled()) {
+      std::vector<char> bundle_used(gmat->num_bundle, colsampler.AllFeatures() ? 1 : 0);
+      const std::vector<unsigned> &fset = colsampler.TreeFeatures();
+      for (size_t k = 0; k < fset.size(); ++k) {
+        bundle_used[gmat->feat2bundle[fset[k]]] = 1;
+      }
+      hbundle.clear();
+      for (unsigned b = 0; b < gmat->num_bundle; ++b) {
+        if (bundle_used[b] != 0) hbundle.push_back(b);
+      }
+      avg_row_len = static_cast<double>(hbundle.size());
+      return;
+    }
+    if (colsampler.AllFeatures()) {
+      hrow_ptr = &gmat->row_ptr[0];
+      hindex = gmat->index.size() == 0 ? NULL : &gmat->index[0];
+      hfindex = gmat->findex.size() == 0 ? NULL : &gmat->findex[0];
+      hfindex_wide = gmat->findex_wide.size() == 0 ? NULL : &gmat->findex_wide[0];
+      hdense = gmat->dense;
+      avg_row_len = static_cast<double>(gmat->index.size()) / std::max(gmat->NumRow(), size_t(1));
+      return;
+    }
+    // the copied entries keep their feature, even when the matrix is dense
+    std::vector<char> feat_used(gmat->cut.NumFeature(), 0);
+    const std::vector<unsigned> &fset = colsampler.TreeFeatures();
+    for (size_t k = 0; k < fset.size(); ++k) {
+      feat_used[fset[k]] = 1;
+    }
+    const long nactive = static_cast<long>(active_rows.size());
+    sub_row_ptr.assign(gmat->NumRow() + 1, 0);
+    #pragma omp parallel for schedule(static)
+    for (long k = 0; k < nactive; ++k) {
+      const bst_uint ridx = active_rows[k];
+      size_t cnt = 0;
+      for (size_t i = gmat->row_ptr[ridx]; i < gmat->row_ptr[ridx + 1]; ++i) {
+        cnt += feat_used[gmat->EntryFeature(ridx, i)];
+      }
+      sub_row_ptr[ridx + 1] = cnt;
+    }
+    for (size_t i = 1; i < sub_row_ptr.size(); ++i) {
+      sub_row_ptr[i] += sub_row_ptr[i - 1];
+    }
+    const bool wide = gmat->findex_wide.size() != 0;
+    sub_index.resize(sub_row_ptr.back());
+    sub_findex.resize(wide ? 0 : sub_row_ptr.back());
+    sub_findex_wide.resize(wide ? sub_row_ptr.back() : 0);
+    #pragma omp parallel for schedule(static)
+    for (long k = 0; k < nactive; ++k) {
+      const bst_uint ridx = active_rows[k];
+      size_t pos = sub_row_ptr[ridx];
+      for (size_t i = gmat->row_ptr[ridx]; i < gmat->row_ptr[ridx + 1]; ++i) {
+        const unsigned fid = gmat->EntryFeature(ridx, i);
+        if (feat_used[fid] == 0) continue;
+        sub_index[pos] = gmat->index[i];
+        if (wide) {
+          sub_findex_wide[pos] = fid;
+        } else {
+          sub_findex[pos] = static_cast<uint16_t>(fid);
+        }
+        ++pos;
+      }
+    }
+    hrow_ptr = &sub_row_ptr[0];
+    hindex = sub_index.size() == 0 ? NULL : &sub_index[0];
+    hfindex = sub_findex.size() == 0 ? NULL : &sub_findex[0];
+    hfindex_wide = sub_findex_wide.size() == 0 ? NULL : &sub_findex_wide[0];
+    hdense = false;
+    avg_row_len = static_cast<double>(sub_index.size()) / std::max(active_rows.size(), size_t(1));
+  }
+  // map the nodes in qexpand to their position in qexpand, other nodes are mapped to -1
+  inline void InitNode2Slot(void) {
+    node2slot.resize(tree.param.num_nodes);
+    std::fill(node2slot.begin(), node2slot.end(), -1);
+    for (size_t j = 0; j < qexpand.size(); ++j) {
+      node2slot[qexpand[j]] = static_cast<int>(j);
+    }
+  }
+  // initialize the statistics of the nodes in qexpand by summing the instances in them
+  inline void InitNewNode(void) {
+    const int nthread = omp_get_max_threads();
+    this->InitNode2Slot();
+    for (int tid = 0; tid < nthread; ++tid) {
+      std::vector< TStats, utils::AlignedAllocator<TStats> > &ts = TGradient::ThreadStats(threadtemp[tid]);
+      ts.resize(qexpand.size());
+      std::fill(ts.begin(), ts.end(), TStats());
+    }
+    std::vector<RowSetCollection::Block> blocks;
+    row_set.MakeBlocks(qexpand, blocks);
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int k = 0; k < static_cast<int>(blocks.size()); ++k) {
+      const RowSetCollection::Block &b = blocks[k];
+      this->SumRange(b.begin, b.end, TGradient::ThreadStats(threadtemp[omp_get_thread_num()])[b.slot]);
+    }
+    snode.resize(tree.param.num_nodes, NodeEntry());
+    for (size_t j = 0; j < qexpand.size(); ++j) {
+      NodeEntry &e = snode[qexpand[j]];
+      e.stats.Clear();
+      for (int tid = 0; tid < nthread; ++tid) {
+        e.stats.Add(TGradient::ThreadStats(threadtemp[tid])[j]);
+      }
+      e.num_row = static_cast<bst_uint>(row_set[qexpand[j]].size());
+      e.root_gain = static_cast<float>(this->CalcGain(e.stats));
+      e.weight = static_cast<float>(this->CalcWeight(e.stats));
+      e.best = SplitEntry();
+    }
+  }
+  /*!
+   * \brief whether the histogram of nid is obtained by subtracting its sibling from the parent,
+   *        the child with fewer instances is built, ties go to the left child
+   */
+  inline bool UseSubtraction(int nid) const {
+    if (tree[nid].is_root() || !hpool.Has(tree[nid].parent())) return false;
+    const int pid = tree[nid].parent();
+    const bool left = tree[nid].is_left_child();
+    const bst_uint nself = snode[nid].num_row;
+    const bst_uint nsib = snode[left ? tree[pid].cright() : tree[pid].cleft()].num_row;
+    return nself > nsib || (nself == nsib && !left);
+  }
+  // the statistics of the nodes and the histograms are in units of the quantized gradients
+  // when they are used, they are scaled back to double only to evaluate the gain and the weight
+  inline double CalcGain(const TStats &s) const {
+    return param.CalcGain(s.sum_grad * gscale, s.sum_hess * hscale);
+  }
+  inline double CalcWeight(const TStats &s) const {
+    return param.CalcWeight(s.sum_grad * gscale, s.sum_hess * hscale);
+  }
+  inline double SumHess(const TStats &s) const {
+    return s.sum_hess * hscale;
+  }
+  // add the gradients of the rows in [begin, end) of the row index array to s
+  inline void SumRange(size_t begin, size_t end, TStats &s) const {
+    for (size_t i = begin; i < end; ++i) {
+      const bst_uint ridx = row_set.row_index[i];
+      s.Add(gpair.Grad(ridx), gpair.Hess(ridx));
+    }
+  }
+  // add the rows in [begin, end) of the row index array to histogram h
+  inline void BuildHistRange(size_t begin, size_t end, TStats *h) const {
+    if (gmat->IsBundled()) {
+      const size_t nbundle = gmat->num_bundle, nused = hbundle.size();
+      const unsigned *bbin = &gmat->bundle_bin[0];
+      for (size_t i = begin; i < end; ++i) {
+        const bst_uint ridx = row_set.row_index[i];
+        const TValue g = gpair.Grad(ridx), hs = gpair.Hess(ridx);
+        const uint8_t *slot = &gmat->bundle_index[0] + ridx * nbundle;
+        for (size_t j = 0; j < nused; ++j) {
+          const size_t b = hbundle[j];
+          h[bbin[b * HistIndexMatrix::kBundleCode + slot[b]]].Add(g, hs);
+        }
+      }
+      return;
+    }
+    const unsigned *fptr = &gmat->cut.row_ptr[0];
+    if (hdense) {
+      // entry f of a dense row is feature f
+      for (size_t i = begin; i < end; ++i) {
+        const bst_uint ridx = row_set.row_index[i];
+        const TValue g = gpair.Grad(ridx), hs = gpair.Hess(ridx);
+        const uint8_t *bin = hindex + hrow_ptr[ridx];
+        const size_t len = hrow_ptr[ridx + 1] - hrow_ptr[ridx];
+        for (size_t f = 0; f < len; ++f) {
+          h[fptr[f] + bin[f]].Add(g, hs);
+        }
+      }
+      return;
+    }
+    if (hfindex_wide != NULL) {
+      this->BuildHistSparse(begin, end, hfindex_wide, h);
+    } else {
+      this->BuildHistSparse(begin, end, hfindex, h);
+    }
+  }
+  // add the rows in [begin, end) of the sparse entries, whose features are feat, to histogram h
+  template<typename TFeat>
+  inline void BuildHistSparse(size_t begin, size_t end, const TFeat *feat, TStats *h) const {
+    const unsigned *fptr = &gmat->cut.row_ptr[0];
+    for (size_t i = begin; i < end; ++i) {
+      const bst_uint ridx = row_set.row_index[i];
+      const TValue g = gpair.Grad(ridx), hs = gpair.Hess(ridx);
+      for (size_t k = hrow_ptr[ridx]; k < hrow_ptr[ridx + 1]; ++k) {
+        h[fptr[feat[k]] + hindex[k]].Add(g, hs);
+      }
+    }
+  }
+  // add the bins of the features in [fbegin, fend) of the rows in [begin, end) of the row index array to histogram h
+  inline void BuildHistBinRange(size_t begin, size_t end,
+                                unsigned fbegin, unsigned fend, TStats *h) const {
+    if (hfindex_wide != NULL) {
+      this->BuildHistBinRange(begin, end, fbegin, fend, hfindex_wide, h); return;
+    }
+    if (!hdense) {
+      this->BuildHistBinRange(begin, end, fbegin, fend, hfindex, h); return;
+    }
+    const unsigned *fptr = &gmat->cut.row_ptr[0];
+    for (size_t i = begin; i < end; ++i) {
+      const bst_uint ridx = row_set.row_index[i];
+      const TValue g = gpair.Grad(ridx), hs = gpair.Hess(ridx);
+      const uint8_t *bin = hindex + hrow_ptr[ridx];
+      for (unsigned f = fbegin; f < fend; ++f) {
+        h[fptr[f] + bin[f]].Add(g, hs);
+      }
+    }
+  }
+  // the sparse entries whose features are feat, each row is searched for its first feature in range
+  template<typename TFeat>
+  inline void BuildHistBinRange(size_t begin, size_t end, unsigned fbegin, unsigned fend,
+                                const TFeat *feat, TStats *h) const {
+    const unsigned *fptr = &gmat->cut.row_ptr[0];
+    for (size_t i = begin; i < end; ++i) {
+      const bst_uint ridx = row_set.row_index[i];
+      const TValue g = gpair.Grad(ridx), hs = gpair.Hess(ridx);
+      const TFeat *rend = feat + hrow_ptr[ridx + 1];
+      for (const TFeat *p = std::lower_bound(feat + hrow_ptr[ridx], rend, fbegin);
+           p != rend && *p < fend; ++p) {
+        h[fptr[*p] + hindex[p - feat]].Add(g, hs);
+      }
+    }
+  }
+  // add the bundles hbundle[jbegin, jend) of the rows in [begin, end) of the row index array to histogram h,
+  // the empty slots are skipped, as the spare bin is shared by the threads
+  inline void BuildHistBundleRange(size_t begin, size_t end,
+                                   size_t jbegin, size_t jend, TStats *h) const {
+    const size_t nbundle = gmat->num_bundle;
+    const unsigned nbin = gmat->cut.NumBin();
+    const unsigned *bbin = &gmat->bundle_bin[0];
+    for (size_t i = begin; i < end; ++i) {
+      const bst_uint ridx = row_set.row_index[i];
+      const TValue g = gpair.Grad(ridx), hs = gpair.Hess(ridx);
+      const uint8_t *slot = &gmat->bundle_index[0] + ridx * nbundle;
+      for (size_t j = jbegin; j < jend; ++j) {
+        const size_t b = hbundle[j];
+        const unsigned bin = bbin[b * HistIndexMatrix::kBundleCode + slot[b]];
+        if (bin != nbin) h[bin].Add(g, hs);
+      }
+    }
+  }
+  /*!
+   * \brief choose how the histogram of a node is built, from the shape of the level:
+   *        nodes holding at most the share of one thread are built by one thread each,
+   *        so levels with many small nodes run in parallel across nodes; a larger node is
+   *        split by rows when it has enough rows to pay for reducing the per thread histograms,
+   *        otherwise it is split by features, each thread owns the bins of some features or bundles
+   * \param nrow number of rows of the node
+   * \param total_row number of rows of all the nodes built in this level
+   */
+  inline BuildMode ChooseBuildMode(size_t nrow, size_t total_row) const {
+    const size_t nthread = static_cast<size_t>(omp_get_max_threads());
+    if (nthread == 1 || nrow * nthread <= total_row) return kNodeParallel;
+    // splitting by rows costs about two passes over one histogram per thread (clear and reduce),
+    // splitting by features costs a binary search in every row of the node per thread,
+    // the slots of a bundle are found directly
+    if (gmat->IsBundled()) {
+      if (hbundle.size() >= nthread && nrow < 2.0 * gmat->cut.NumBin()) return kFeatParallel;
+      return kRowParallel;
+    }
+    const double search_cost = static_cast<double>(nrow) * (1.0 + std::log(avg_row_len + 1.0) / std::log(2.0));
+    if (colsampler.TreeFeatures().size() >= nthread && search_cost < 2.0 * gmat->cut.NumBin()) {
+      return kFeatParallel;
+    }
+    return kRowParallel;
+  }
+  // build the histograms of all the nodes in qexpand from their rows
+  inline void BuildHist(void) {
+    const size_t nbin = gmat->cut.NumBin();
+    std::vector<int> qsubtract, qbuild, qnode, qrow, qfeat;
+    for (size_t j = 0; j < qexpand.size(); ++j) {
+      hpool.Alloc(qexpand[j]);
+    }
+    // the pool may move its buffers during allocation, take the pointers afterwards
+    hist.resize(qexpand.size());
+    size_t total_row = 0;
+    for (size_t j = 0; j < qexpand.size(); ++j) {
+      const int nid = qexpand[j];
+      hist[j] = hpool.Get(nid);
+      if (this->UseSubtraction(nid)) {
+        qsubtract.push_back(nid);
+      } else {
+        qbuild.push_back(static_cast<int>(j));
+        total_row += row_set[nid].size();
+      }
+    }
+    for (size_t k = 0; k < qbuild.size(); ++k) {
+      switch (this->ChooseBuildMode(row_set[qexpand[qbuild[k]]].size(), total_row)) {
+        case kNodeParallel: qnode.push_back(qbuild[k]); break;
+        case kRowParallel: qrow.push_back(qbuild[k]); break;
+        case kFeatParallel: qfeat.push_back(qbuild[k]); break;
+        default: utils::Error("unknown build mode");
+      }
+    }
+    // small nodes: one thread builds the whole histogram of a node
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int k = 0; k < static_cast<int>(qnode.size()); ++k) {
+      const RowSetCollection::Elem &e = row_set[qexpand[qnode[k]]];
+      this->BuildHistRange(e.begin, e.end, hist[qnode[k]]);
+    }
+    // nodes with few rows and many bins: each thread builds the bins of a range of features
+    for (size_t k = 0; k < qfeat.size(); ++k) {
+      const RowSetCollection::Elem &e = row_set[qexpand[qfeat[k]]];
+      TStats *h = hist[qfeat[k]];
+      const std::vector<unsigned> &fptr = gmat->cut.row_ptr;
+      #pragma omp parallel
+      {
+        const unsigned tid = static_cast<unsigned>(omp_get_thread_num());
+        const unsigned nthread = static_cast<unsigned>(omp_get_num_threads());
+        if (gmat->IsBundled()) {
+          // the bundles hold disjoint bins, each thread takes a range of them
+          const size_t nused = hbundle.size();
+          const size_t jbegin = nused * tid / nthread, jend = nused * (tid + 1) / nthread;
+          this->BuildHistBundleRange(e.begin, e.end, jbegin, jend, h);
+        } else {
+          // cut the features into ranges holding about the same number of bins
+          const unsigned step = static_cast<unsigned>((nbin + nthread - 1) / nthread);
+          const unsigned fbegin = static_cast<unsigned>(std::lower_bound(fptr.begin(), fptr.end(),
+              std::min(step * tid, fptr.back())) - fptr.begin());
+          const unsigned fend = static_cast<unsigned>(std::lower_bound(fptr.begin(), fptr.end(),
+              std::min(step * (tid + 1), fptr.back())) - fptr.begin());
+          if (fbegin < fend) this->BuildHistBinRange(e.begin, e.end, fbegin, fend, h);
+        }
+      }
+    }
+    // large nodes: the rows are shared by the threads, each thread builds a partial histogram
+    for (size_t k = 0; k < qrow.size(); ++k) {
+      const RowSetCollection::Elem &e = row_set[qexpand[qrow[k]]];
+      TStats *h = hist[qrow[k]];
+      #pragma omp parallel
+      {
+        const int tid = omp_get_thread_num();
+        const size_t nthread = static_cast<size_t>(omp_get_num_threads());
+        const size_t step = (e.size() + nthread - 1) / nthread;
+        const size_t begin = std::min(e.begin + step * tid, e.end);
+        const size_t end = std::min(begin + step, e.end);
+        TStats *out = h;
+        if (tid != 0) {
+          std::vector< TStats, utils::AlignedAllocator<TStats> > &th = TGradient::ThreadHist(threadtemp[tid]);
+          th.resize(nhist);
+          std::fill(th.begin(), th.end(), TStats());
+          out = &th[0];
+        }
+        this->BuildHistRange(begin, end, out);
+        #pragma omp barrier
+        #pragma omp for schedule(static)
+        for (long i = 0; i < static_cast<long>(nbin); ++i) {
+          for (size_t t = 1; t < nthread; ++t) {
+            h[i].Add(TGradient::ThreadHist(threadtemp[t])[i]);
+          }
+        }
+      }
+    }
+    // larger sibling = parent - smaller sibling
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int k = 0; k < static_cast<int>(qsubtract.size()); ++k) {
+      const int nid = qsubtract[k];
+      const int pid = tree[nid].parent();
+      const int sib = tree[nid].is_left_child() ? tree[pid].cright() : tree[pid].cleft();
+      const TStats *parent = hpool.Get(pid);
+      const TStats *sibling = hist[node2slot[sib]];
+      TStats *h = hist[node2slot[nid]];
+      for (size_t i = 0; i < nbin; ++i) {
+        h[i].SetSubstract(parent[i], sibling[i]);
+      }
+    }
+    // both children exist, the parent histograms are no longer needed
+    for (size_t j = 0; j < qexpand.size(); ++j) {
+      if (!tree[qexpand[j]].is_root()) hpool.Release(tree[qexpand[j]].parent());
+    }
+  }
+  /*!
+   * \brief enumerate the split points of one feature on the histogram of a node,
+   *        the histogram only holds the present values, the missing ones are the rest of the node
+   */
+  inline void EnumerateSplit(int nid, unsigned fid, const TStats *h, SplitEntry &best) {
+    if (fcat.IsCategorical(fid)) {
+      this->EnumerateSplitCat(nid, fid, h, best, ctemp[omp_get_thread_num()]); return;
+    }
+    const NodeEntry &e = snode[nid];
+    const unsigned begin = gmat->cut.row_ptr[fid];
+    const unsigned end = gmat->cut.row_ptr[fid + 1];
+    if (begin == end) return;
+    TStats s, c;
+    // default_direction, 0: learn, 1: left, 2: right
+    if (param.default_direction != 1) {
+      // bins up to i go to left, the rest and the missing values go to right
+      for (unsigned i = begin; i < end; ++i) {
+        s.Add(h[i]);
+        if (this->SumHess(s) < param.min_child_weight) continue;
+        c.SetSubstract(e.stats, s);
+        if (this->SumHess(c) < param.min_child_weight) continue;
+        const double loss_chg = this->CalcGain(s) + this->CalcGain(c) - e.root_gain;
+        best.Update(static_cast<float>(loss_chg), fid, gmat->cut.cut[i], false);
+      }
+    }
+    if (param.default_direction != 2) {
+      // bins from i go to right, the rest and the missing values go to left
+      s.Clear();
+      for (unsigned i = end - 1; i > begin; --i) {
+        s.Add(h[i]);
+        if (this->SumHess(s) < param.min_child_weight) continue;
+        c.SetSubstract(e.stats, s);
+        if (this->SumHess(c) < param.min_child_weight) continue;
+        const double loss_chg = this->CalcGain(s) + this->CalcGain(c) - e.root_gain;
+        best.Update(static_cast<float>(loss_chg), fid, gmat->cut.cut[i - 1], true);
+      }
+    }
+  }
+  // order the categories of feature fid present in histogram h by sum_grad / (sum_hess + lambda),
+  // the folded bin is left out, it always goes right
+  inline void SortCategory(unsigned fid, const TStats *h, std::vector<CatEntry> &out) const {
+    out.clear();
+    const unsigned fbegin = gmat->cut.row_ptr[fid];
+    for (unsigned i = fbegin; i < gmat->cut.row_ptr[fid + 1]; ++i) {
+      if (h[i].Empty() || gmat->cut.BinCategory(fid, i - fbegin) < 0.0f) continue;
+      out.push_back(CatEntry(h[i].sum_grad * gscale / (h[i].sum_hess * hscale + param.reg_lambda), i));
+    }
+    std::sort(out.begin(), out.end());
+  }
+  /*!
+   * \brief enumerate the category sets of a categorical feature, the sets are the prefixes
+   *        of the categories ordered by gradient ratio, which contain the optimal partition;
+   *        split_value of a candidate is the number of categories in the left set
+   */
+  inline void EnumerateSplitCat(int nid, unsigned fid, const TStats *h,
+                                SplitEntry &best, std::vector<CatEntry> &cats) {
+    const NodeEntry &e = snode[nid];
+    this->SortCategory(fid, h, cats);
+    const unsigned n = static_cast<unsigned>(cats.size());
+    if (n == 0) return;
+    TStats s, c;
+    if (param.default_direction != 1) {
+      // the first k categories go to left, the rest and the missing values go to right
+      for (unsigned k = 0; k < n; ++k) {
+        s.Add(h[cats[k].bin]);
+        if (this->SumHess(s) < param.min_child_weight) continue;
+        c.SetSubstract(e.stats, s);
+        if (this->SumHess(c) < param.min_child_weight) continue;
+        const double loss_chg = this->CalcGain(s) + this->CalcGain(c) - e.root_gain;
+        best.Update(static_cast<float>(loss_chg), fid, static_cast<float>(k + 1), false);
+      }
+    }
+    if (param.default_direction != 2) {
+      // the last categories from k and the folded ones go to right, the rest and the missing values go to left
+      s.Clear();
+      const unsigned flast = gmat->cut.row_ptr[fid + 1] - 1;
+      if (gmat->cut.BinCategory(fid, flast - gmat->cut.row_ptr[fid]) < 0.0f) s.Add(h[flast]);
+      for (unsigned k = n - 1; k > 0; --k) {
+        s.Add(h[cats[k].bin]);
+        if (this->SumHess(s) < param.min_child_weight) continue;
+        c.SetSubstract(e.stats, s);
+        if (this->SumHess(c) < param.min_child_weight) continue;
+        const double loss_chg = this->CalcGain(s) + this->CalcGain(c) - e.root_gain;
+        best.Update(static_cast<float>(loss_chg), fid, static_cast<float>(k), true);
+      }
+    }
+  }
+  /*!
+   * \brief find splits for all the nodes in qexpand from the histograms, each node scans the
+   *        features sampled for its depth, a lossguide step may expand nodes of several depths
+   */
+  inline void FindSplit(void) {
+    // draw the samples first, the sampler may grow its storage while drawing
+    for (size_t j = 0; j < qexpand.size(); ++j) {
+      colsampler.LevelFeatures(tree.GetDepth(qexpand[j]));
+    }
+    std::vector<const std::vector<unsigned>*> fset(qexpand.size());
+    for (size_t j = 0; j < qexpand.size(); ++j) {
+      fset[j] = &colsampler.LevelFeatures(tree.GetDepth(qexpand[j]));
+    }
+    // every depth draws the same number of features
+    const unsigned nfeat = qexpand.size() == 0 ? 0 : static_cast<unsigned>(fset[0]->size());
+    const int nthread = omp_get_max_threads();
+    sbest.resize(nthread);
+    for (int tid = 0; tid < nthread; ++tid) {
+      sbest[tid].resize(qexpand.size());
+      std::fill(sbest[tid].begin(), sbest[tid].end(), SplitEntry());
+    }
+    // one task per (node, feature), so both wide levels with few nodes
+    // and deep levels with few features keep all the threads busy
+    const long ntask = static_cast<long>(qexpand.size()) * nfeat;
+    #pragma omp parallel for schedule(dynamic, 16)
+    for (long k = 0; k < ntask; ++k) {
+      const size_t j = static_cast<size_t>(k / nfeat);
+      const unsigned fid = (*fset[j])[k % nfeat];
+      this->EnumerateSplit(qexpand[j], fid, hist[j], sbest[omp_get_thread_num()][j]);
+    }
+    for (size_t j = 0; j < qexpand.size(); ++j) {
+      const int nid = qexpand[j];
+      NodeEntry &e = snode[nid];
+      for (int tid = 0; tid < nthread; ++tid) {
+        e.best.Update(sbest[tid][j]);
+      }
+      // turn the size of the left set back into the set, with the order used by the search
+      const unsigned fid = e.best.split_index();
+      e.cat_bits.clear();
+      if (e.best.loss_chg > 0.0f && fcat.IsCategorical(fid)) {
+        const unsigned fbegin = gmat->cut.row_ptr[fid];
+        std::vector<CatEntry> &cats = ctemp[0];
+        this->SortCategory(fid, hist[j], cats);
+        e.cat_bits.resize((gmat->cut.NumCategory(fid) + 31) / 32, 0);
+        for (unsigned k = 0; k < static_cast<unsigned>(e.best.split_value); ++k) {
+          const unsigned cat = static_cast<unsigned>(gmat->cut.BinCategory(fid, cats[k].bin - fbegin));
+          e.cat_bits[cat >> 5] |= 1U << (cat & 31U);
+        }
+      }
+      tree.stat(nid).loss_chg = e.best.loss_chg;
+      tree.stat(nid).sum_hess = static_cast<float>(this->SumHess(e.stats));
+      tree.stat(nid).base_weight = e.weight;
+      tree.stat(nid).leaf_child_cnt = 0;
+    }
+  }
+  /*!
+   * \brief split node nid with the best split found, or make it a leaf
+   * \return whether the node is split
+   */
+  inline bool ApplySplit(int nid, int depth) {
+    const NodeEntry &e = snode[nid];
+    // depthwise growth leaves min_split_loss to the pruner, lossguide growth checks it here
+    // so that weak splits do not take the leaves of max_leaves
+    if (e.best.loss_chg > rt_eps &&
+        (param.grow_policy == 0 || !param.need_prune(e.best.loss_chg, depth))) {
+      tree.AddChilds(nid);
+      if (fcat.IsCategorical(e.best.split_index())) {
+        tree.SetCategoricalSplit(nid, e.best.split_index(), e.cat_bits, e.best.default_left());
+      } else {
+        tree[nid].set_split(e.best.split_index(), e.best.split_value, e.best.default_left());
+      }
+      return true;
+    } else {
+      this->SetLeaf(nid);
+      return false;
+    }
+  }
+  // make nid a leaf with its statistics, its histogram is no longer needed
+  inline void SetLeaf(int nid) {
+    const NodeEntry &e = snode[nid];
+    tree.stat(nid).loss_chg = e.best.loss_chg;
+    tree.stat(nid).sum_hess = static_cast<float>(this->SumHess(e.stats));
+    tree.stat(nid).base_weight = e.weight;
+    tree.stat(nid).leaf_child_cnt = 0;
+    tree[nid].set_leaf(e.weight * param.learning_rate);
+    hpool.Release(nid);
+  }
+  // whether a row of a split node goes to left, the split value is one of the cut points,
+  // the local bin of a categorical feature is turned back into its category
+  struct SplitGoLeft {
+    const HistIndexMatrix &gmat;
+    const RegTree &tree;
+    const std::vector<int> &nodes;
+    SplitGoLeft(const HistIndexMatrix &gmat, const RegTree &tree, const std::vector<int> &nodes)
+        : gmat(gmat), tree(tree), nodes(nodes) {}
+    inline bool operator()(int j, bst_uint ridx) const {
+      const RegTree::Node &n = tree[nodes[j]];
+      const unsigned fid = n.split_index();
+      const int bin = gmat.GetBin(ridx, fid);
+      if (bin < 0) return n.default_left();
+      if (n.is_categorical()) return tree.CategoryGoLeft(nodes[j], gmat.cut.BinCategory(fid, bin));
+      return gmat.cut.cut[gmat.cut.row_ptr[fid] + bin] <= n.split_cond();
+    }
+  };
+  // move the instances of the split nodes in qexpand to the children
+  inline void ResetPosition(void) {
+    std::vector<int> nodes, left, right;
+    for (size_t j = 0; j < qexpand.size(); ++j) {
+      const int nid = qexpand[j];
+      if (tree[nid].is_leaf()) continue;
+      nodes.push_back(nid);
+      left.push_back(tree[nid].cleft());
+      right.push_back(tree[nid].cright());
+    }
+    row_set.Partition(nodes, left, right, SplitGoLeft(*gmat, tree, nodes), threadtemp);
+  }
+  // collect the new nodes to be expanded
+  inline void UpdateQueueExpand(void) {
+    std::vector<int> newnodes;
+    for (size_t j = 0; j < qexpand.size(); ++j) {
+      const int nid = qexpand[j];
+      if (!tree[nid].is_leaf()) {
+        newnodes.push_back(tree[nid].cleft());
+        newnodes.push_back(tree[nid].cright());
+      }
+    }
+    qexpand = newnodes;
+  }
+
+ private:
+  /*! \brief quantized feature matrix */
+  const HistIndexMatrix *gmat;
+  /*! \brief rows of each node */
+  RowSetCollection row_set;
+  /*! \brief entries of the features of the tree, used when the tree does not use all the features */
+  std::vector<size_t> sub_row_ptr;
+  std::vector<uint8_t> sub_index;
+  std::vector<uint16_t> sub_findex;
+  std::vector<unsigned> sub_findex_wide;
+  /*! \brief row pointer, local bin and feature of the entries the histograms are built from */
+  const size_t *hrow_ptr;
+  const uint8_t *hindex;
+  const uint16_t *hfindex;
+  const unsigned *hfindex_wide;
+  /*! \brief whether the rows of hindex hold every feature, entry f of a row is then feature f */
+  bool hdense;
+  /*! \brief bundles the histograms are built from, used when the matrix is bundled */
+  std::vector<unsigned> hbundle;
+  /*! \brief average number of entries per row in hindex, or the number of bundles in hbundle */
+  double avg_row_len;
+  /*! \brief number of bins in a histogram, including the spare bin of a bundled matrix */
+  size_t nhist;
+  /*! \brief gradient pairs of the round */
+  TGradient gpair;
+  /*! \brief value of one unit of the gradient and hessian statistics */
+  double gscale, hscale;
+  /*! \brief statistics of each node */
+  std::vector<NodeEntry> snode;
+  /*! \brief position of each expanding node in qexpand, indexed by node id */
+  std::vector<int> node2slot;
+  /*! \brief histograms of the nodes, the histogram of a split node is kept until its children are built */
+  HistPool<TStats> hpool;
+  /*! \brief histogram of each expanding node, indexed by the position in qexpand */
+  std::vector<TStats*> hist;
+  /*! \brief per thread categories of the categorical feature being enumerated */
+  std::vector< std::vector<CatEntry> > ctemp;
+  /*! \brief per thread best split of the expanding nodes */
+  std::vector< std::vector<SplitEntry> > sbest;
+  /*! \brief queue of nodes to be expanded */
+  std::vector<int> qexpand;
+};
+}  // namespace gbm
+}  // namespace xgboost
+#endif
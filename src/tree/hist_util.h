@@ -0,0 +1,732 @@
+#ifndef XGBOOST_TREE_HIST_UTIL_H
+#define XGBOOST_TREE_HIST_UTIL_H
+/*!
+ * \file hist_util.h
+ * \brief utilities for histogram based tree construction:
+ *        cut points of each feature, the quantized feature matrix and the node histograms
+ */
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include "../data.h"
+#include "../utils/utils.h"
+#include "../utils/omp.h"
+#include "../utils/random.h"
+#include "../utils/quantile.h"
+#include "tree_model.h"
+#include "feat_bundle.h"
+
+namespace xgboost {
+namespace gbm {
+/*!
+ * \brief cut points of each feature, bin k of feature f contains values in [cut[k-1], cut[k]);
+ *        a categorical feature has one bin per category id, bin k holds category k, unless it has
+ *        more categories than max_cat_bins: then bin k holds the category cut[k] - 1, the bins are
+ *        given to the most frequent categories and the rest are folded into a last bin whose cut
+ *        is kFoldedCut, the folded categories always go right in a categorical split
+ */
+struct HistCutMatrix {
+  /*! \brief weighted quantile sketch used to propose the cuts */
+  typedef utils::WQuantileSketch<bst_float, double> Sketch;
+  /*!
+   * \brief maximum number of bins of a feature; the quantized matrix stores the local bin
+   *        of each entry as uint8_t, the histogram bin is the local bin plus row_ptr[fid]
+   */
+  static const int kMaxBin = 256;
+  /*! \brief category ids must be below this bound, so that they are exact in float */
+  static const unsigned kMaxCategory = 1U << 24;
+  /*! \brief cut of the bin of the folded categories, larger than every category id */
+  static const unsigned kFoldedCut = 1U << 25;
+  /*! \brief memory bound of the sketches that are alive at the same time in Init */
+  static const size_t kSketchBytes = 1 << 28;
+  /*! \brief start of the bins of each feature in the global bin index, size = num_feature + 1 */
+  std::vector<unsigned> row_ptr;
+  /*! \brief upper bound of each bin, the last cut of a feature is larger than all the values */
+  std::vector<bst_float> cut;
+  /*! \brief whether each feature is categorical, empty when no feature is */
+  std::vector<bool> is_cat;
+  /*! \return number of features */
+  inline unsigned NumFeature(void) const {
+    return static_cast<unsigned>(row_ptr.size() - 1);
+  }
+  /*! \return total number of bins */
+  inline unsigned NumBin(void) const {
+    return row_ptr.back();
+  }
+  /*! \brief get local bin index of a feature value */
+  inline unsigned GetBin(unsigned fid, bst_float fvalue) const {
+    const bst_float *begin = &cut[0] + row_ptr[fid];
+    const bst_float *end = &cut[0] + row_ptr[fid + 1];
+    const bst_float *it = std::upper_bound(begin, end, fvalue);
+    if (it == end) --it;
+    // a category without a bin of its own is in the folded bin, the last one
+    if (fid < is_cat.size() && is_cat[fid] && *it != fvalue + 1.0f) {
+      utils::Assert(end[-1] == static_cast<bst_float>(kFoldedCut), "HistCutMatrix: unknown category");
+      return static_cast<unsigned>(end - begin - 1);
+    }
+    return static_cast<unsigned>(it - begin);
+  }
+  /*! \return the category of local bin of categorical feature fid, -1 for the folded bin */
+  inline bst_float BinCategory(unsigned fid, unsigned bin) const {
+    const bst_float c = cut[row_ptr[fid] + bin];
+    return c == static_cast<bst_float>(kFoldedCut) ? -1.0f : c - 1.0f;
+  }
+  /*! \return one more than the largest category with a bin of its own of categorical feature fid */
+  inline unsigned NumCategory(unsigned fid) const {
+    const unsigned nbin = row_ptr[fid + 1] - row_ptr[fid];
+    if (nbin == 0) return 0;
+    const bst_float c = cut[row_ptr[fid + 1] - 1];
+    if (c != static_cast<bst_float>(kFoldedCut)) return static_cast<unsigned>(c);
+    return nbin == 1 ? 0 : static_cast<unsigned>(cut[row_ptr[fid + 1] - 2]);
+  }
+  /*!
+   * \brief propose the cut points with a weighted quantile sketch of each feature,
+   *        each bin holds about the same amount of weight; only the rows are read,
+   *        each thread sketches a range of rows and the summaries are merged;
+   *        the features are taken in blocks, one pass over the rows per block,
+   *        so that the sketches of all the threads stay within kSketchBytes
+   * \param fmat feature matrix, column access is not needed
+   * \param nrow number of rows in fmat
+   * \param max_bin maximum number of bins of each feature
+   * \param sketch_eps rank error bound of the sketch
+   * \param weight weight of each row, usually the hessian, empty means all rows have weight 1
+   * \param fcat whether each feature is categorical, features beyond the end are not
+   * \param max_cat_bins maximum number of bins of a categorical feature
+   */
+  inline void Init(const IFMatrix &fmat, size_t nrow, int max_bin, float sketch_eps,
+                   const std::vector<float> &weight, const std::vector<bool> &fcat,
+                   int max_cat_bins) {
+    utils::Check(max_bin > 1 && max_bin <= kMaxBin, "max_bin must be in [2, %d]", kMaxBin);
+    utils::Check(max_cat_bins > 1 && max_cat_bins <= kMaxBin, "max_cat_bins must be in [2, %d]", kMaxBin);
+    const unsigned nfeat = static_cast<unsigned>(fmat.NumCol());
+    const size_t max_thread = static_cast<size_t>(omp_get_max_threads());
+    Sketch probe;
+    probe.Init(std::max((nrow + max_thread - 1) / max_thread, static_cast<size_t>(1)), sketch_eps);
+    const unsigned fstep = static_cast<unsigned>(std::max(static_cast<size_t>(1),
+        std::min(static_cast<size_t>(nfeat), kSketchBytes / (max_thread * probe.MaxBytes()))));
+    std::vector< std::vector<Sketch> > sketchs(max_thread);
+    // number of categories of each categorical feature of the block, seen by each thread
+    std::vector< std::vector<unsigned> > ncats(max_thread);
+    // number of rows of each category, only for the features with more than max_cat_bins categories
+    std::vector< std::vector<unsigned> > ccount;
+    std::vector< std::vector<bst_float> > fcut(nfeat);
+    for (unsigned fbegin = 0; fbegin < nfeat; fbegin += fstep) {
+      const unsigned fend = std::min(nfeat, fbegin + fstep);
+      // the sketches of the previous block give their memory back
+      for (size_t tid = 0; tid < max_thread; ++tid) {
+        sketchs[tid].clear(); ncats[tid].clear();
+      }
+      #pragma omp parallel
+      {
+        const int tid = omp_get_thread_num();
+        const size_t nthread = static_cast<size_t>(omp_get_num_threads());
+        const size_t step = (nrow + nthread - 1) / nthread;
+        const size_t begin = std::min(step * tid, nrow);
+        const size_t end = std::min(begin + step, nrow);
+        std::vector<Sketch> &sketch = sketchs[tid];
+        std::vector<unsigned> &ncat = ncats[tid];
+        sketch.resize(fend - fbegin);
+        ncat.assign(fend - fbegin, 0);
+        for (unsigned fid = fbegin; fid < fend; ++fid) {
+          sketch[fid - fbegin].Init(end - begin, sketch_eps);
+        }
+        for (size_t i = begin; i < end; ++i) {
+          const double w = weight.size() == 0 ? 1.0 : weight[i];
+          for (IFMatrix::RowIter it = fmat.GetRow(i); it.Next();) {
+            const unsigned fid = it.findex();
+            if (fid < fbegin || fid >= fend) continue;
+            if (fid < fcat.size() && fcat[fid]) {
+              const bst_float v = it.fvalue();
+              utils::Check(v >= 0.0f && v < kMaxCategory && v == std::floor(v),
+                           "categorical feature %u: value must be an integer in [0, %u)", fid, kMaxCategory);
+              ncat[fid - fbegin] = std::max(ncat[fid - fbegin], static_cast<unsigned>(v) + 1);
+            } else {
+              sketch[fid - fbegin].Push(it.fvalue(), w);
+            }
+          }
+        }
+      }
+      // the features with too many categories count the rows of each category in one more pass
+      ccount.clear(); ccount.resize(fend - fbegin);
+      bool need_count = false;
+      for (unsigned fid = fbegin; fid < fend; ++fid) {
+        if (fid >= fcat.size() || !fcat[fid]) continue;
+        unsigned n = 0;
+        for (size_t tid = 0; tid < ncats.size(); ++tid) {
+          if (ncats[tid].size() != 0) n = std::max(n, ncats[tid][fid - fbegin]);
+        }
+        if (n <= static_cast<unsigned>(max_cat_bins)) {
+          for (unsigned k = 0; k < n; ++k) {
+            fcut[fid].push_back(static_cast<bst_float>(k + 1));
+          }
+        } else {
+          ccount[fid - fbegin].resize(n, 0);
+          need_count = true;
+        }
+      }
+      if (need_count) {
+        const long ndata = static_cast<long>(nrow);
+        #pragma omp parallel for schedule(static)
+        for (long i = 0; i < ndata; ++i) {
+          for (IFMatrix::RowIter it = fmat.GetRow(i); it.Next();) {
+            const unsigned fid = it.findex();
+            if (fid < fbegin || fid >= fend || ccount[fid - fbegin].size() == 0) continue;
+            unsigned &c = ccount[fid - fbegin][static_cast<unsigned>(it.fvalue())];
+            #pragma omp atomic
+            c += 1;
+          }
+        }
+      }
+      #pragma omp parallel for schedule(dynamic, 1)
+      for (unsigned fid = fbegin; fid < fend; ++fid) {
+        if (fid < fcat.size() && fcat[fid]) {
+          if (ccount[fid - fbegin].size() != 0) {
+            HistCutMatrix::MakeCategoryCut(ccount[fid - fbegin], max_cat_bins, fcut[fid]);
+          }
+          continue;
+        }
+        Sketch::Summary summary, part, temp;
+        for (size_t tid = 0; tid < sketchs.size(); ++tid) {
+          if (sketchs[tid].size() == 0) continue;
+          sketchs[tid][fid - fbegin].GetSummary(part);
+          temp.SetCombine(summary, part);
+          summary.data.swap(temp.data);
+        }
+        HistCutMatrix::MakeCut(summary, max_bin, fcut[fid]);
+      }
+    }
+    this->Set(fcut);
+    is_cat.clear();
+    for (unsigned fid = 0; fid < nfeat; ++fid) {
+      if (fid < fcat.size() && fcat[fid]) {
+        is_cat.resize(nfeat, false); is_cat[fid] = true;
+      }
+    }
+  }
+  /*!
+   * \brief make the cuts of a categorical feature with more than max_cat_bins categories,
+   *        every category present gets a bin when they fit, otherwise the max_cat_bins - 1
+   *        most frequent ones do and the rest share the folded bin
+   * \param count number of rows of each category
+   * \param max_cat_bins maximum number of bins
+   * \param out the cuts, category + 1 of each bin by category, then kFoldedCut if some are folded
+   */
+  inline static void MakeCategoryCut(const std::vector<unsigned> &count, int max_cat_bins,
+                                     std::vector<bst_float> &out) {
+    // (number of rows, category) of the categories present
+    std::vector< std::pair<unsigned, unsigned> > present;
+    for (size_t k = 0; k < count.size(); ++k) {
+      if (count[k] != 0) present.push_back(std::make_pair(count[k], static_cast<unsigned>(k)));
+    }
+    const bool fold = present.size() > static_cast<size_t>(max_cat_bins);
+    if (fold) {
+      const size_t nkeep = static_cast<size_t>(max_cat_bins - 1);
+      std::partial_sort(present.begin(), present.begin() + nkeep, present.end(), CmpCategoryCount);
+      present.resize(nkeep);
+    }
+    std::vector<unsigned> kept;
+    for (size_t k = 0; k < present.size(); ++k) {
+      kept.push_back(present[k].second);
+    }
+    std::sort(kept.begin(), kept.end());
+    out.clear();
+    for (size_t k = 0; k < kept.size(); ++k) {
+      out.push_back(static_cast<bst_float>(kept[k] + 1));
+    }
+    if (fold) out.push_back(static_cast<bst_float>(kFoldedCut));
+  }
+  // more rows first, ties by smaller category
+  inline static bool CmpCategoryCount(const std::pair<unsigned, unsigned> &a,
+                                      const std::pair<unsigned, unsigned> &b) {
+    if (a.first != b.first) return a.first > b.first;
+    return a.second < b.second;
+  }
+  /*!
+   * \brief set the cuts from the cuts of each feature
+   * \param fcut cuts of each feature
+   */
+  inline void Set(const std::vector< std::vector<bst_float> > &fcut) {
+    row_ptr.resize(1, 0); cut.clear();
+    for (size_t fid = 0; fid < fcut.size(); ++fid) {
+      cut.insert(cut.end(), fcut[fid].begin(), fcut[fid].end());
+      row_ptr.push_back(static_cast<unsigned>(cut.size()));
+    }
+  }
+  /*!
+   * \brief make the cuts of one feature from its quantile summary,
+   *        the summary is pruned to max_bin entries, and the cuts are
+   *        placed in the middle of two neighbouring entries
+   * \param summary quantile summary of the feature
+   * \param max_bin maximum number of bins
+   * \param out the cuts, the last cut is larger than all the values
+   */
+  inline static void MakeCut(const Sketch::Summary &summary, int max_bin,
+                             std::vector<bst_float> &out) {
+    out.clear();
+    if (summary.data.size() == 0) return;
+    Sketch::Summary pruned;
+    pruned.SetPrune(summary, static_cast<size_t>(max_bin));
+    for (size_t i = 1; i < pruned.data.size(); ++i) {
+      out.push_back((pruned.data[i - 1].value + pruned.data[i].value) * 0.5f);
+    }
+    const bst_float vmax = pruned.data.back().value;
+    out.push_back(vmax + std::fabs(vmax) * 1e-5f + 1e-5f);
+  }
+};
+
+/*!
+ * \brief feature matrix quantized into bin index, stored by row;
+ *        each entry keeps its local bin as uint8_t, the bin in the histogram is the local bin
+ *        plus cut.row_ptr of its feature; the entries of a row are sorted by feature, so the
+ *        rows of a node can be streamed when building its histogram; each entry also keeps
+ *        its feature, as uint16_t unless there are more than kMaxNarrowFeature features,
+ *        except when every row holds every feature: entry k of a row is then feature k;
+ *        when the features fall into few bundles of mutually exclusive features,
+ *        the matrix is stored densely instead, with one uint8_t code per (row, bundle)
+ */
+struct HistIndexMatrix {
+  /*! \brief number of codes of a bundle, the codes of a slot are uint8_t */
+  static const unsigned kBundleCode = 256;
+  /*! \brief the features of the entries are stored as uint16_t up to this number of features */
+  static const unsigned kMaxNarrowFeature = 1U << 16;
+  /*! \brief cut points used to quantize the matrix */
+  HistCutMatrix cut;
+  /*! \brief start of each row in index, size = num_row + 1 */
+  std::vector<size_t> row_ptr;
+  /*! \brief local bin of each entry, empty when the matrix is bundled */
+  std::vector<uint8_t> index;
+  /*! \brief feature of each entry, empty when the matrix is dense, bundled or has wide features */
+  std::vector<uint16_t> findex;
+  /*! \brief feature of each entry when there are more than kMaxNarrowFeature features */
+  std::vector<unsigned> findex_wide;
+  /*! \brief bundle of each feature, empty when the matrix is not bundled */
+  std::vector<unsigned> feat2bundle;
+  /*!
+   * \brief code of each (row, bundle) slot, stored by row; the features of a bundle take
+   *        consecutive codes, code 0 marks a slot whose bundle has no entry in the row,
+   *        unless the bundle is a single feature present in every row
+   */
+  std::vector<uint8_t> bundle_index;
+  /*!
+   * \brief histogram bin of each code of each bundle, kBundleCode per bundle: cut.row_ptr of the
+   *        feature of the code plus its local bin; the empty code maps to the spare bin NumBin()
+   */
+  std::vector<unsigned> bundle_bin;
+  /*! \brief number of bundles, 0 when the matrix is not bundled */
+  unsigned num_bundle;
+  /*! \brief whether every row holds every feature once, set when the matrix is not bundled */
+  bool dense;
+  HistIndexMatrix(void) : num_bundle(0), dense(false) {}
+  /*! \return number of rows */
+  inline size_t NumRow(void) const {
+    return row_ptr.size() - 1;
+  }
+  /*! \return whether the matrix is stored by bundle */
+  inline bool IsBundled(void) const {
+    return num_bundle != 0;
+  }
+  /*! \return feature of entry k of the sparse storage, which starts row ridx */
+  inline unsigned EntryFeature(bst_uint ridx, size_t k) const {
+    if (dense) return static_cast<unsigned>(k - row_ptr[ridx]);
+    return findex_wide.size() != 0 ? findex_wide[k] : findex[k];
+  }
+  /*!
+   * \brief get the local bin of feature fid in row ridx
+   * \return the local bin index, -1 if the feature is missing in the row
+   */
+  inline int GetBin(bst_uint ridx, unsigned fid) const {
+    if (this->IsBundled()) {
+      const size_t b = feat2bundle[fid];
+      const unsigned bin = bundle_bin[b * kBundleCode + bundle_index[static_cast<size_t>(ridx) * num_bundle + b]];
+      if (bin < cut.row_ptr[fid] || bin >= cut.row_ptr[fid + 1]) return -1;
+      return static_cast<int>(bin - cut.row_ptr[fid]);
+    }
+    if (dense) return index[row_ptr[ridx] + fid];
+    if (row_ptr[ridx] == row_ptr[ridx + 1]) return -1;
+    if (findex_wide.size() != 0) return this->FindBin(&findex_wide[0], ridx, fid);
+    return this->FindBin(&findex[0], ridx, fid);
+  }
+  /*!
+   * \brief quantize the feature matrix
+   * \param fmat feature matrix, only the rows are read
+   * \param nrow number of rows in fmat
+   * \param max_bin maximum number of bins of each feature
+   * \param sketch_eps rank error bound of the sketch used to propose the cuts
+   * \param weight weight of each row used to propose the cuts
+   * \param fcat whether each feature is categorical
+   * \param max_cat_bins maximum number of bins of a categorical feature
+   * \param enable_bundle whether the exclusive features may be bundled
+   * \param max_conflict_rate fraction of the rows in which the features of a bundle may collide,
+   *        the entries that lose a collision are treated as missing
+   */
+  inline void Init(const IFMatrix &fmat, size_t nrow, int max_bin, float sketch_eps,
+                   const std::vector<float> &weight, const std::vector<bool> &fcat,
+                   int max_cat_bins, bool enable_bundle, float max_conflict_rate) {
+    cut.Init(fmat, nrow, max_bin, sketch_eps, weight, fcat, max_cat_bins);
+    const unsigned nfeat = cut.NumFeature();
+    const bst_uint ndata = static_cast<bst_uint>(nrow);
+    row_ptr.resize(nrow + 1);
+    row_ptr[0] = 0;
+    for (bst_uint i = 0; i < ndata; ++i) {
+      size_t len = 0;
+      for (IFMatrix::RowIter it = fmat.GetRow(i); it.Next();) {
+        if (it.findex() < nfeat) ++len;
+      }
+      row_ptr[i + 1] = row_ptr[i] + len;
+    }
+    const bool wide = nfeat > kMaxNarrowFeature;
+    index.resize(row_ptr.back());
+    findex.clear(); findex_wide.clear();
+    if (wide) {
+      findex_wide.resize(row_ptr.back());
+    } else {
+      findex.resize(row_ptr.back());
+    }
+    // the rows that do not hold every feature once, the feature index is kept for them
+    long nsparse = 0;
+    #pragma omp parallel
+    {
+      std::vector< std::pair<unsigned, unsigned> > entry;
+      #pragma omp for schedule(static) reduction(+:nsparse)
+      for (bst_uint i = 0; i < ndata; ++i) {
+        entry.clear();
+        for (IFMatrix::RowIter it = fmat.GetRow(i); it.Next();) {
+          const unsigned fid = it.findex();
+          if (fid >= nfeat) continue;
+          entry.push_back(std::make_pair(fid, cut.GetBin(fid, it.fvalue())));
+        }
+        std::sort(entry.begin(), entry.end());
+        bool full = entry.size() == nfeat;
+        for (size_t j = 0; j < entry.size(); ++j) {
+          if (wide) {
+            findex_wide[row_ptr[i] + j] = entry[j].first;
+          } else {
+            findex[row_ptr[i] + j] = static_cast<uint16_t>(entry[j].first);
+          }
+          index[row_ptr[i] + j] = static_cast<uint8_t>(entry[j].second);
+          full = full && entry[j].first == j;
+        }
+        if (!full) ++nsparse;
+      }
+    }
+    dense = nsparse == 0;
+    if (dense) {
+      std::vector<uint16_t>().swap(findex);
+      std::vector<unsigned>().swap(findex_wide);
+    }
+    num_bundle = 0;
+    feat2bundle.clear();
+    bundle_index.clear();
+    bundle_bin.clear();
+    if (enable_bundle) this->InitBundle(fmat, max_conflict_rate);
+  }
+
+ private:
+  /*!
+   * \brief switch to the bundled storage when the dense slots take no more room than
+   *        the entries and row pointers of the sparse storage, i.e. most rows fill most bundles,
+   *        as with one-hot encoded categorical variables or dense data with missing values
+   */
+  inline void InitBundle(const IFMatrix &fmat, float max_conflict_rate) {
+    const size_t nrow = this->NumRow();
+    if (nrow == 0) return;
+    const unsigned nfeat = cut.NumFeature();
+    const size_t nbyte = index.size() + findex.size() * sizeof(uint16_t) +
+        findex_wide.size() * sizeof(unsigned) + nrow * sizeof(size_t);
+    const size_t max_bundle = nbyte / nrow;
+    std::vector<unsigned> feat_nbin(nfeat);
+    for (unsigned fid = 0; fid < nfeat; ++fid) {
+      feat_nbin[fid] = cut.row_ptr[fid + 1] - cut.row_ptr[fid];
+    }
+    const unsigned nbundle = FeatureBundler::Find(fmat, nrow, nfeat, feat_nbin, kBundleCode,
+                                                  max_conflict_rate, max_bundle, feat2bundle);
+    if (nbundle == 0) {
+      feat2bundle.clear(); return;
+    }
+    // rows of each feature, the features without entries take no code
+    std::vector<size_t> feat_nent(nfeat, 0);
+    for (bst_uint i = 0; i < static_cast<bst_uint>(nrow); ++i) {
+      for (size_t k = row_ptr[i]; k < row_ptr[i + 1]; ++k) {
+        const unsigned fid = this->EntryFeature(i, k);
+        if (k == row_ptr[i] || fid != this->EntryFeature(i, k - 1)) ++feat_nent[fid];
+      }
+    }
+    // the features of a bundle take consecutive codes from 1, after the empty code 0,
+    // a bundle that is one feature present in every row is never empty and starts at 0
+    std::vector<unsigned> bundle_nfeat(nbundle, 0);
+    std::vector<bool> bundle_full(nbundle, false);
+    for (unsigned fid = 0; fid < nfeat; ++fid) {
+      if (feat_nent[fid] == 0) continue;
+      bundle_full[feat2bundle[fid]] = feat_nent[fid] == nrow;
+      ++bundle_nfeat[feat2bundle[fid]];
+    }
+    const unsigned nbin = cut.NumBin();
+    std::vector<unsigned> next_code(nbundle), feat_code(nfeat, 0);
+    bundle_bin.assign(static_cast<size_t>(nbundle) * kBundleCode, nbin);
+    for (unsigned b = 0; b < nbundle; ++b) {
+      next_code[b] = bundle_nfeat[b] == 1 && bundle_full[b] ? 0 : 1;
+    }
+    for (unsigned fid = 0; fid < nfeat; ++fid) {
+      if (feat_nent[fid] == 0) continue;
+      const unsigned b = feat2bundle[fid];
+      utils::Assert(next_code[b] + feat_nbin[fid] <= kBundleCode, "HistIndexMatrix: bundle exceeds its codes");
+      feat_code[fid] = next_code[b];
+      for (unsigned k = 0; k < feat_nbin[fid]; ++k) {
+        bundle_bin[static_cast<size_t>(b) * kBundleCode + next_code[b] + k] = cut.row_ptr[fid] + k;
+      }
+      next_code[b] += feat_nbin[fid];
+    }
+    bundle_index.resize(nrow * nbundle, 0);
+    const bst_uint ndata = static_cast<bst_uint>(nrow);
+    #pragma omp parallel
+    {
+      std::vector<bool> taken(nbundle);
+      #pragma omp for schedule(static)
+      for (bst_uint i = 0; i < ndata; ++i) {
+        uint8_t *slot = &bundle_index[static_cast<size_t>(i) * nbundle];
+        std::fill(taken.begin(), taken.end(), false);
+        for (size_t k = row_ptr[i]; k < row_ptr[i + 1]; ++k) {
+          // on a collision the feature with the smaller index keeps the slot
+          const unsigned fid = this->EntryFeature(i, k);
+          if (taken[feat2bundle[fid]]) continue;
+          taken[feat2bundle[fid]] = true;
+          slot[feat2bundle[fid]] = static_cast<uint8_t>(feat_code[fid] + index[k]);
+        }
+      }
+    }
+    num_bundle = nbundle;
+    dense = false;
+    std::vector<uint8_t>().swap(index);
+    std::vector<uint16_t>().swap(findex);
+    std::vector<unsigned>().swap(findex_wide);
+  }
+  // local bin of feature fid in the sparse row ridx, whose entries have features feat
+  template<typename TFeat>
+  inline int FindBin(const TFeat *feat, bst_uint ridx, unsigned fid) const {
+    const TFeat *end = feat + row_ptr[ridx + 1];
+    const TFeat *it = std::lower_bound(feat + row_ptr[ridx], end, fid);
+    if (it == end || *it != fid) return -1;
+    return index[it - feat];
+  }
+};
+
+/*!
+ * \brief quantized matrix cached between boosting rounds, a new booster is created
+ *        every round, so the cache is owned by the model and handed to its boosters;
+ *        the owner calls Clear when the training data changes, the matrix is also rebuilt
+ *        when its shape or the sketch setting differs from the cached one;
+ *        the cuts are weighted by the hessian of the round that built the cache
+ */
+class HistIndexCache {
+ public:
+  HistIndexCache(void) {
+    this->Clear();
+  }
+  /*! \brief forget the cached matrix, it is built again at the next Get */
+  inline void Clear(void) {
+    fmat_ = NULL; num_col_ = 0; max_bin_ = 0; sketch_eps_ = 0.0f;
+    fcat_.clear(); max_cat_bins_ = 0; enable_bundle_ = false; max_conflict_rate_ = 0.0f;
+    index_.row_ptr.clear();
+  }
+  /*!
+   * \brief get quantized matrix of fmat, it is only rebuilt when the data or the sketch setting changes
+   * \param fmat feature matrix
+   * \param nrow number of rows in fmat
+   * \param max_bin maximum number of bins of each feature
+   * \param sketch_eps rank error bound of the sketch used to propose the cuts
+   * \param weight weight of each row used to propose the cuts
+   * \param fcat whether each feature is categorical
+   * \param max_cat_bins maximum number of bins of a categorical feature
+   * \param enable_bundle whether the exclusive features may be bundled
+   * \param max_conflict_rate fraction of the rows in which the features of a bundle may collide
+   */
+  inline const HistIndexMatrix &Get(const IFMatrix &fmat, size_t nrow, int max_bin,
+                                    float sketch_eps, const std::vector<float> &weight,
+                                    const std::vector<bool> &fcat, int max_cat_bins,
+                                    bool enable_bundle, float max_conflict_rate) {
+    if (fmat_ != &fmat || num_col_ != fmat.NumCol() || index_.row_ptr.size() != nrow + 1 ||
+        max_bin_ != max_bin || sketch_eps_ != sketch_eps || fcat_ != fcat ||
+        max_cat_bins_ != max_cat_bins ||
+        enable_bundle_ != enable_bundle || max_conflict_rate_ != max_conflict_rate) {
+      index_.Init(fmat, nrow, max_bin, sketch_eps, weight, fcat, max_cat_bins,
+                  enable_bundle, max_conflict_rate);
+      fmat_ = &fmat; num_col_ = fmat.NumCol();
+      max_bin_ = max_bin; sketch_eps_ = sketch_eps; fcat_ = fcat; max_cat_bins_ = max_cat_bins;
+      enable_bundle_ = enable_bundle; max_conflict_rate_ = max_conflict_rate;
+    }
+    return index_;
+  }
+
+ private:
+  // the cached matrix can be large, the cache is not copyable
+  HistIndexCache(const HistIndexCache &other);
+  HistIndexCache &operator=(const HistIndexCache &other);
+  /*! \brief matrix the index is built from, only compared with, never dereferenced */
+  const IFMatrix *fmat_;
+  /*! \brief number of columns of the matrix */
+  size_t num_col_;
+  /*! \brief max_bin used to build the index */
+  int max_bin_;
+  /*! \brief sketch_eps used to build the index */
+  float sketch_eps_;
+  /*! \brief categorical features used to build the index */
+  std::vector<bool> fcat_;
+  /*! \brief max_cat_bins used to build the index */
+  int max_cat_bins_;
+  /*! \brief enable_bundle used to build the index */
+  bool enable_bundle_;
+  /*! \brief max_conflict_rate used to build the index */
+  float max_conflict_rate_;
+  /*! \brief cached index */
+  HistIndexMatrix index_;
+};
+
+/*!
+ * \brief gradient pairs of a round quantized to 16 bit fixed point, with one scale for the
+ *        gradients and one for the hessians; the histograms built from them are summed
+ *        in integers, see QuantStats
+ */
+struct QuantizedGradient {
+  /*! \brief largest magnitude of a quantized value */
+  static const int kMaxValue = 32767;
+  /*! \brief quantized gradient pair of a row */
+  struct Entry {
+    short grad;
+    short hess;
+  };
+  /*! \brief quantized pair of each row, only the active rows are filled */
+  std::vector<Entry> data;
+  /*! \brief value of one unit of the quantized gradient and hessian */
+  double grad_scale, hess_scale;
+  /*!
+   * \brief quantize the gradients of the active rows, rounding to nearest
+   * \param grad first order gradient of each row
+   * \param hess second order gradient of each row
+   * \param rows the active rows
+   */
+  inline void Init(const std::vector<float> &grad, const std::vector<float> &hess,
+                   const std::vector<bst_uint> &rows) {
+    const long nrow = static_cast<long>(rows.size());
+    std::vector<double> gmax(omp_get_max_threads(), 0.0), hmax(gmax.size(), 0.0);
+    #pragma omp parallel for schedule(static)
+    for (long k = 0; k < nrow; ++k) {
+      const int tid = omp_get_thread_num();
+      gmax[tid] = std::max(gmax[tid], std::fabs(static_cast<double>(grad[rows[k]])));
+      hmax[tid] = std::max(hmax[tid], std::fabs(static_cast<double>(hess[rows[k]])));
+    }
+    const double gm = *std::max_element(gmax.begin(), gmax.end());
+    const double hm = *std::max_element(hmax.begin(), hmax.end());
+    grad_scale = gm > 0.0 ? gm / kMaxValue : 1.0;
+    hess_scale = hm > 0.0 ? hm / kMaxValue : 1.0;
+    data.resize(grad.size());
+    #pragma omp parallel for schedule(static)
+    for (long k = 0; k < nrow; ++k) {
+      Entry &e = data[rows[k]];
+      e.grad = static_cast<short>(std::floor(grad[rows[k]] / grad_scale + 0.5));
+      e.hess = static_cast<short>(std::floor(hess[rows[k]] / hess_scale + 0.5));
+    }
+  }
+};
+
+/*!
+ * \brief statistics summed from the quantized gradient pairs, in units of grad_scale and hess_scale,
+ *        the sums are integers, so they do not depend on the order in which the threads add them,
+ *        and sibling subtraction is exact; they are scaled to double only to evaluate a split
+ */
+struct QuantStats {
+  /*! \brief sum of the quantized first order gradient */
+  int64_t sum_grad;
+  /*! \brief sum of the quantized second order gradient */
+  int64_t sum_hess;
+  /*! \brief constructor */
+  QuantStats(void) {
+    this->Clear();
+  }
+  /*! \brief clear the statistics */
+  inline void Clear(void) {
+    sum_grad = sum_hess = 0;
+  }
+  /*! \brief whether the statistics is empty */
+  inline bool Empty(void) const {
+    return sum_hess == 0;
+  }
+  /*! \brief add statistics of one instance */
+  inline void Add(int64_t grad, int64_t hess) {
+    sum_grad += grad; sum_hess += hess;
+  }
+  /*! \brief add another statistics */
+  inline void Add(const QuantStats &b) {
+    this->Add(b.sum_grad, b.sum_hess);
+  }
+  /*! \brief set current value to a - b */
+  inline void SetSubstract(const QuantStats &a, const QuantStats &b) {
+    sum_grad = a.sum_grad - b.sum_grad;
+    sum_hess = a.sum_hess - b.sum_hess;
+  }
+};
+
+/*!
+ * \brief pool of the gradient histograms of the tree nodes,
+ *        the buffer of a released histogram is recycled by the next allocated node
+ * \tparam TStats statistics type of a bin, GradStats or QuantStats
+ */
+template<typename TStats>
+class HistPool {
+ public:
+  /*!
+   * \brief clear the pool
+   * \param nbin number of bins in one histogram
+   */
+  inline void Init(size_t nbin) {
+    nbin_ = nbin;
+    node2slot_.clear();
+    free_slot_.clear();
+    for (size_t i = 0; i < data_.size(); ++i) {
+      free_slot_.push_back(static_cast<int>(i));
+    }
+  }
+  /*! \brief allocate a zero filled histogram for node nid */
+  inline TStats *Alloc(int nid) {
+    if (node2slot_.size() <= static_cast<size_t>(nid)) node2slot_.resize(nid + 1, -1);
+    utils::Assert(node2slot_[nid] == -1, "HistPool: histogram of the node already exists");
+    int slot;
+    if (free_slot_.size() != 0) {
+      slot = free_slot_.back(); free_slot_.pop_back();
+    } else {
+      slot = static_cast<int>(data_.size());
+      data_.push_back(std::vector<TStats>());
+    }
+    data_[slot].resize(nbin_);
+    std::fill(data_[slot].begin(), data_[slot].end(), TStats());
+    node2slot_[nid] = slot;
+    return &data_[slot][0];
+  }
+  /*! \brief whether node nid owns a histogram */
+  inline bool Has(int nid) const {
+    return static_cast<size_t>(nid) < node2slot_.size() && node2slot_[nid] != -1;
+  }
+  /*! \brief get the histogram of node nid */
+  inline TStats *Get(int nid) {
+    utils::Assert(this->Has(nid), "HistPool: histogram of the node does not exist");
+    return &data_[node2slot_[nid]][0];
+  }
+  /*! \brief give the histogram of node nid back to the pool */
+  inline void Release(int nid) {
+    if (!this->Has(nid)) return;
+    free_slot_.push_back(node2slot_[nid]);
+    node2slot_[nid] = -1;
+  }
+
+ private:
+  /*! \brief number of bins in one histogram */
+  size_t nbin_;
+  /*! \brief histogram buffers */
+  std::vector< std::vector<TStats> > data_;
+  /*! \brief buffer used by each node, -1 means no histogram */
+  std::vector<int> node2slot_;
+  /*! \brief buffers that are not used by any node */
+  std::vector<int> free_slot_;
+};
+}  // namespace gbm
+}  // namespace xgboost
+#endif
@@ -0,0 +1,178 @@
+#ifndef XGBOOST_TREE_QUICK_SCORER_H
+#define XGBOOST_TREE_QUICK_SCORER_H
+/*!
+ * \file quick_scorer.h
+ * \brief QuickScorer traversal of an ensemble of small trees: the leaves of each tree are numbered
+ *        from left to right in the bits of a 64 bit word, each split clears the leaves of its left
+ *        subtree when an instance goes right, the exit leaf is the lowest bit left after all the
+ *        splits of the instance are applied; the splits are grouped by feature and sorted by
+ *        threshold, so an instance scans the thresholds below its feature values instead of branching
+ */
+#include <vector>
+#include <algorithm>
+#include "../utils/utils.h"
+#include "tree_model.h"
+
+namespace xgboost {
+namespace gbm {
+/*! \brief bitvector scorer of trees with at most 64 leaves, one root and no categorical split */
+class QuickScorer {
+ public:
+  /*! \brief maximum number of leaves of a tree */
+  static const unsigned kMaxLeaf = 64;
+  /*! \brief remove all the trees */
+  inline void Clear(void) {
+    conds_.clear();
+    leaf_value_.clear(); leaf_ptr_.clear(); leaf_ptr_.push_back(0);
+    fids_.clear(); fptr_.clear(); thr_.clear(); tree_.clear(); mask_.clear();
+    mptr_.clear(); mtree_.clear(); mmask_.clear();
+  }
+  QuickScorer(void) {
+    this->Clear();
+  }
+  /*! \return number of trees added */
+  inline size_t NumTree(void) const {
+    return leaf_ptr_.size() - 1;
+  }
+  /*!
+   * \brief add a tree, Finalize must be called before scoring
+   * \return false if the tree can not be scored this way, the scorer is then left unchanged
+   */
+  inline bool AddTree(const RegTree &tree) {
+    if (tree.param.num_roots != 1) return false;
+    const size_t nleaf_begin = leaf_value_.size(), ncond_begin = conds_.size();
+    unsigned nleaf = 0;
+    if (!this->Visit(tree, 0, static_cast<unsigned>(this->NumTree()), nleaf)) {
+      leaf_value_.resize(nleaf_begin); conds_.resize(ncond_begin);
+      return false;
+    }
+    leaf_ptr_.push_back(static_cast<unsigned>(leaf_value_.size()));
+    return true;
+  }
+  /*! \brief group the splits of the added trees by feature, sorted by threshold */
+  inline void Finalize(void) {
+    std::sort(conds_.begin(), conds_.end(), CmpCond);
+    fids_.clear(); fptr_.clear(); thr_.clear(); tree_.clear(); mask_.clear();
+    mptr_.clear(); mtree_.clear(); mmask_.clear();
+    for (size_t i = 0; i < conds_.size(); ++i) {
+      const Cond &c = conds_[i];
+      if (fids_.size() == 0 || fids_.back() != c.fid) {
+        fids_.push_back(c.fid);
+        fptr_.push_back(static_cast<unsigned>(thr_.size()));
+        mptr_.push_back(static_cast<unsigned>(mtree_.size()));
+      }
+      thr_.push_back(c.thr); tree_.push_back(c.tid); mask_.push_back(c.mask);
+      // a missing value takes the default direction, only the ones going right clear leaves
+      if (!c.default_left) {
+        mtree_.push_back(c.tid); mmask_.push_back(c.mask);
+      }
+    }
+    fptr_.push_back(static_cast<unsigned>(thr_.size()));
+    mptr_.push_back(static_cast<unsigned>(mtree_.size()));
+  }
+  /*!
+   * \brief add the predictions of all the trees for an instance to psum, in tree order;
+   *        the scan visits the splits of every tree, so the scorer only suits instances
+   *        that need all the trees, not the ones that resume from a buffered prefix
+   * \param feat dense feature vector of the instance
+   * \param funknown whether each feature is missing, features beyond its size are missing
+   * \param psum sum to add to
+   * \param v scratch, one word per tree
+   */
+  template<typename TFeat, typename TUnknown>
+  inline float Predict(const TFeat &feat, const TUnknown &funknown,
+                       float psum, std::vector<uint64_t> &v) const {
+    const size_t ntree = this->NumTree();
+    v.resize(ntree);
+    std::fill(v.begin(), v.end(), ~static_cast<uint64_t>(0));
+    for (size_t i = 0; i < fids_.size(); ++i) {
+      const unsigned fid = fids_[i];
+      if (fid >= funknown.size() || funknown[fid]) {
+        for (unsigned k = mptr_[i]; k < mptr_[i + 1]; ++k) v[mtree_[k]] &= mmask_[k];
+      } else {
+        // the splits with threshold <= value send the instance right, the rest are ignored
+        const float fvalue = feat[fid];
+        for (unsigned k = fptr_[i]; k < fptr_[i + 1] && !(fvalue < thr_[k]); ++k) {
+          v[tree_[k]] &= mask_[k];
+        }
+      }
+    }
+    for (size_t t = 0; t < ntree; ++t) {
+      psum += leaf_value_[leaf_ptr_[t] + LowestBit(v[t])];
+    }
+    return psum;
+  }
+
+ private:
+  /*! \brief a split of a tree */
+  struct Cond {
+    /*! \brief split feature */
+    unsigned fid;
+    /*! \brief threshold, the instance goes left when its value is smaller */
+    float thr;
+    /*! \brief tree of the split */
+    unsigned tid;
+    /*! \brief whether a missing value goes left */
+    bool default_left;
+    /*! \brief leaves still reachable when the instance goes right */
+    uint64_t mask;
+  };
+  inline static bool CmpCond(const Cond &a, const Cond &b) {
+    if (a.fid != b.fid) return a.fid < b.fid;
+    if (a.thr != b.thr) return a.thr < b.thr;
+    return a.tid < b.tid;
+  }
+  // number the leaves under nid from nleaf on, from left to right, and record the splits
+  inline bool Visit(const RegTree &tree, int nid, unsigned tid, unsigned &nleaf) {
+    const RegTree::Node &n = tree[nid];
+    if (n.is_leaf()) {
+      if (nleaf >= kMaxLeaf) return false;
+      leaf_value_.push_back(n.leaf_value());
+      ++nleaf;
+      return true;
+    }
+    if (n.is_categorical()) return false;
+    const unsigned lbegin = nleaf;
+    if (!this->Visit(tree, n.cleft(), tid, nleaf)) return false;
+    const unsigned lend = nleaf;
+    if (!this->Visit(tree, n.cright(), tid, nleaf)) return false;
+    Cond c;
+    c.fid = n.split_index(); c.thr = n.split_cond(); c.tid = tid;
+    c.default_left = n.default_left();
+    // clear bits [lbegin, lend), lend - lbegin < 64 since the right subtree has a leaf
+    c.mask = ~(((static_cast<uint64_t>(1) << (lend - lbegin)) - 1) << lbegin);
+    conds_.push_back(c);
+    return true;
+  }
+  // index of the lowest set bit of x, x is not 0
+  inline static unsigned LowestBit(uint64_t x) {
+#if defined(__GNUC__)
+    return static_cast<unsigned>(__builtin_ctzll(x));
+#else
+    unsigned k = 0;
+    while ((x & 1) == 0) {
+      x >>= 1; ++k;
+    }
+    return k;
+#endif
+  }
+  /*! \brief splits of the added trees */
+  std::vector<Cond> conds_;
+  /*! \brief leaf values, the leaves of tree t are leaf_value_[leaf_ptr_[t], leaf_ptr_[t + 1]) from left to right */
+  std::vector<float> leaf_value_;
+  std::vector<unsigned> leaf_ptr_;
+  /*! \brief features used by the splits, ascending */
+  std::vector<unsigned> fids_;
+  /*! \brief splits of feature fids_[i] are [fptr_[i], fptr_[i + 1]) of thr_, tree_ and mask_, by threshold */
+  std::vector<unsigned> fptr_;
+  std::vector<float> thr_;
+  std::vector<unsigned> tree_;
+  std::vector<uint64_t> mask_;
+  /*! \brief splits of feature fids_[i] going right on missing value are [mptr_[i], mptr_[i + 1]) of mtree_ and mmask_ */
+  std::vector<unsigned> mptr_;
+  std::vector<unsigned> mtree_;
+  std::vector<uint64_t> mmask_;
+};
+}  // namespace gbm
+}  // namespace xgboost
+#endif
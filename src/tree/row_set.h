@@ -0,0 +1,293 @@
+#ifndef XGBOOST_TREE_ROW_SET_H
+#define XGBOOST_TREE_ROW_SET_H
+/*!
+ * \file row_set.h
+ * \brief row index sets of the tree nodes, all the rows of a node lie in a contiguous
+ *        range of one row index array, which is partitioned in place when the node splits
+ */
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include "../data.h"
+#include "../utils/utils.h"
+#include "../utils/omp.h"
+#include "../utils/random.h"
+#include "thread_workspace.h"
+
+namespace xgboost {
+namespace gbm {
+/*!
+ * \brief draw a sample of the rows, each block of rows has its own generator
+ *        seeded by the block index, so the sample does not depend on the number of threads
+ * \param nrow number of rows
+ * \param seed seed of this sample
+ * \param fkeep functor, fkeep(ridx, rnd) tells whether row ridx is kept, rnd is the generator of the block
+ * \param out the kept rows, in ascending order
+ */
+template<typename FKeep>
+inline void SampleRowsByBlock(size_t nrow, uint32_t seed, const FKeep &fkeep, std::vector<bst_uint> &out) {
+  const size_t kBlock = 4096;
+  const int nblock = static_cast<int>((nrow + kBlock - 1) / kBlock);
+  // pass 1 counts the kept rows of each block, pass 2 replays the same stream to write them
+  std::vector<size_t> bptr(nblock + 1, 0);
+  #pragma omp parallel for schedule(static)
+  for (int b = 0; b < nblock; ++b) {
+    random::XorShift rnd((static_cast<uint64_t>(seed) << 32) | static_cast<uint64_t>(b));
+    const size_t end = std::min(nrow, (b + 1) * kBlock);
+    size_t cnt = 0;
+    for (size_t i = b * kBlock; i < end; ++i) {
+      if (fkeep(i, rnd)) ++cnt;
+    }
+    bptr[b + 1] = cnt;
+  }
+  for (int b = 0; b < nblock; ++b) bptr[b + 1] += bptr[b];
+  out.resize(bptr[nblock]);
+  #pragma omp parallel for schedule(static)
+  for (int b = 0; b < nblock; ++b) {
+    random::XorShift rnd((static_cast<uint64_t>(seed) << 32) | static_cast<uint64_t>(b));
+    const size_t end = std::min(nrow, (b + 1) * kBlock);
+    size_t k = bptr[b];
+    for (size_t i = b * kBlock; i < end; ++i) {
+      if (fkeep(i, rnd)) out[k++] = static_cast<bst_uint>(i);
+    }
+  }
+}
+// keep each row with the same probability
+struct UniformKeep {
+  double prob;
+  explicit UniformKeep(double prob) : prob(prob) {}
+  inline bool operator()(size_t ridx, random::XorShift &rnd) const {
+    return rnd.NextDouble() < prob;
+  }
+};
+// keep the rows marked as top, and the others with probability prob
+struct GOSSKeep {
+  const std::vector<char> &top;
+  double prob;
+  GOSSKeep(const std::vector<char> &top, double prob) : top(top), prob(prob) {}
+  inline bool operator()(size_t ridx, random::XorShift &rnd) const {
+    if (top[ridx] != 0) return true;
+    return rnd.NextDouble() < prob;
+  }
+};
+// order of the rows by |gradient| descending, ties broken by row index
+struct AbsGradGreater {
+  const std::vector<float> &grad;
+  explicit AbsGradGreater(const std::vector<float> &grad) : grad(grad) {}
+  inline bool operator()(bst_uint a, bst_uint b) const {
+    const float ga = std::fabs(grad[a]), gb = std::fabs(grad[b]);
+    return ga > gb || (ga == gb && a < b);
+  }
+};
+/*!
+ * \brief draw a uniform subsample of the rows
+ * \param nrow number of rows
+ * \param subsample probability to keep a row
+ * \param seed seed of this sample
+ * \param out the kept rows, in ascending order
+ */
+inline void SampleRows(size_t nrow, float subsample, uint32_t seed, std::vector<bst_uint> &out) {
+  SampleRowsByBlock(nrow, seed, UniformKeep(subsample), out);
+}
+/*!
+ * \brief gradient based one-side sampling: keep the top_rate fraction of rows with the largest
+ *        |gradient|, and draw other_rate of all the rows from the rest; the gradient and hessian
+ *        of the drawn rows are scaled by (1 - top_rate) / other_rate, so the sums stay unbiased
+ * \param grad gradient of each row, scaled in place
+ * \param hess hessian of each row, scaled in place
+ * \param top_rate fraction of rows always kept
+ * \param other_rate fraction of rows drawn from the rest
+ * \param seed seed of this sample
+ * \param out the kept rows, in ascending order
+ */
+inline void SampleRowsGOSS(std::vector<float> &grad, std::vector<float> &hess,
+                           float top_rate, float other_rate, uint32_t seed,
+                           std::vector<bst_uint> &out) {
+  const size_t nrow = grad.size();
+  const size_t ntop = static_cast<size_t>(top_rate * nrow);
+  std::vector<char> top(nrow, 0);
+  if (ntop != 0) {
+    std::vector<bst_uint> order(nrow);
+    for (size_t i = 0; i < nrow; ++i) order[i] = static_cast<bst_uint>(i);
+    std::nth_element(order.begin(), order.begin() + (ntop - 1), order.end(), AbsGradGreater(grad));
+    for (size_t i = 0; i < ntop; ++i) top[order[i]] = 1;
+  }
+  const double prob = std::min(1.0, static_cast<double>(other_rate) / (1.0 - top_rate));
+  SampleRowsByBlock(nrow, seed, GOSSKeep(top, prob), out);
+  const float scale = static_cast<float>(1.0 / prob);
+  #pragma omp parallel for schedule(static)
+  for (long k = 0; k < static_cast<long>(out.size()); ++k) {
+    const bst_uint ridx = out[k];
+    if (top[ridx] != 0) continue;
+    grad[ridx] *= scale; hess[ridx] *= scale;
+  }
+}
+
+/*! \brief row index sets of the tree nodes */
+class RowSetCollection {
+ public:
+  /*! \brief range of a node in the row index array */
+  struct Elem {
+    size_t begin, end;
+    Elem(void) : begin(0), end(0) {}
+    Elem(size_t begin, size_t end) : begin(begin), end(end) {}
+    inline size_t size(void) const {
+      return end - begin;
+    }
+  };
+  /*! \brief a block of rows of a node, unit of parallel work */
+  struct Block {
+    /*! \brief position of the node in the node list */
+    int slot;
+    /*! \brief range of the block in the row index array */
+    size_t begin, end;
+    Block(int slot, size_t begin, size_t end) : slot(slot), begin(begin), end(end) {}
+  };
+  /*! \brief number of rows in one block */
+  static const size_t kBlockSize = 2048;
+  /*! \brief row index array, sorted ascendingly inside each node */
+  std::vector<bst_uint> row_index;
+  /*!
+   * \brief put every row into its root
+   * \param nrow number of rows
+   * \param num_roots number of roots
+   * \param group_id root of each row, empty means every row is in root 0
+   */
+  inline void Init(size_t nrow, int num_roots, const std::vector<unsigned> &group_id) {
+    row_index.resize(nrow);
+    for (size_t i = 0; i < nrow; ++i) row_index[i] = static_cast<bst_uint>(i);
+    this->GroupByRoot(num_roots, group_id);
+  }
+  /*!
+   * \brief put only the given rows into their roots, the other rows are never visited
+   * \param rows the active rows in ascending order
+   * \param num_roots number of roots
+   * \param group_id root of each row, empty means every row is in root 0
+   */
+  inline void Init(const std::vector<bst_uint> &rows, int num_roots, const std::vector<unsigned> &group_id) {
+    row_index = rows;
+    this->GroupByRoot(num_roots, group_id);
+  }
+  /*! \brief get the range of node nid */
+  inline const Elem &operator[](int nid) const {
+    return elem_[nid];
+  }
+  /*!
+   * \brief cut the rows of the nodes into blocks of at most kBlockSize rows
+   * \param nodes list of nodes
+   * \param out the blocks, in the order of the nodes and of the rows
+   */
+  inline void MakeBlocks(const std::vector<int> &nodes, std::vector<Block> &out) const {
+    out.clear();
+    for (size_t j = 0; j < nodes.size(); ++j) {
+      const Elem &e = elem_[nodes[j]];
+      for (size_t b = e.begin; b < e.end; b += kBlockSize) {
+        out.push_back(Block(static_cast<int>(j), b, std::min(b + kBlockSize, e.end)));
+      }
+    }
+  }
+  /*!
+   * \brief stable partition of the rows of split nodes into their children, in place,
+   *        parallel across nodes and across blocks inside a node
+   * \param nodes the split nodes
+   * \param left left child of each node in nodes
+   * \param right right child of each node in nodes
+   * \param fleft functor, fleft(j, ridx) tells whether row ridx of nodes[j] goes to left
+   * \param temp per thread scratch, must have an entry for each thread
+   */
+  template<typename FGoLeft>
+  inline void Partition(const std::vector<int> &nodes,
+                        const std::vector<int> &left,
+                        const std::vector<int> &right,
+                        const FGoLeft &fleft,
+                        ThreadWorkspace &temp) {
+    std::vector<Block> blocks;
+    this->MakeBlocks(nodes, blocks);
+    const int nblock = static_cast<int>(blocks.size());
+    utils::Assert(temp.Size() >= static_cast<size_t>(omp_get_max_threads()),
+                  "RowSetCollection: not enough thread scratch");
+    // output of each block: thread that processed it, its offsets in the scratch of the thread,
+    // and the number of rows going to left
+    std::vector<int> btid(nblock);
+    std::vector<size_t> loff(nblock), roff(nblock), bleft(nblock);
+    for (size_t i = 0; i < temp.Size(); ++i) {
+      temp[i].left.clear(); temp[i].right.clear();
+    }
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int k = 0; k < nblock; ++k) {
+      TreeThreadEntry &t = temp[omp_get_thread_num()];
+      const Block &b = blocks[k];
+      btid[k] = omp_get_thread_num();
+      loff[k] = t.left.size();
+      roff[k] = t.right.size();
+      for (size_t i = b.begin; i < b.end; ++i) {
+        const bst_uint ridx = row_index[i];
+        if (fleft(b.slot, ridx)) {
+          t.left.push_back(ridx);
+        } else {
+          t.right.push_back(ridx);
+        }
+      }
+      bleft[k] = t.left.size() - loff[k];
+    }
+    // destination of each block inside the left and right part of its node, blocks keep their order
+    std::vector<size_t> lpos(nblock), rpos(nblock);
+    std::vector<size_t> nleft(nodes.size(), 0), nright(nodes.size(), 0);
+    for (int k = 0; k < nblock; ++k) {
+      const int j = blocks[k].slot;
+      lpos[k] = nleft[j];
+      rpos[k] = nright[j];
+      nleft[j] += bleft[k];
+      nright[j] += blocks[k].end - blocks[k].begin - bleft[k];
+    }
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int k = 0; k < nblock; ++k) {
+      const Block &b = blocks[k];
+      const TreeThreadEntry &t = temp[btid[k]];
+      const size_t begin = elem_[nodes[b.slot]].begin;
+      const size_t nl = bleft[k], nr = b.end - b.begin - bleft[k];
+      std::copy(t.left.begin() + loff[k], t.left.begin() + loff[k] + nl,
+                row_index.begin() + begin + lpos[k]);
+      std::copy(t.right.begin() + roff[k], t.right.begin() + roff[k] + nr,
+                row_index.begin() + begin + nleft[b.slot] + rpos[k]);
+    }
+    for (size_t j = 0; j < nodes.size(); ++j) {
+      const Elem e = elem_[nodes[j]];
+      const int nmax = std::max(left[j], right[j]);
+      if (elem_.size() <= static_cast<size_t>(nmax)) elem_.resize(nmax + 1);
+      elem_[left[j]] = Elem(e.begin, e.begin + nleft[j]);
+      elem_[right[j]] = Elem(e.begin + nleft[j], e.end);
+    }
+  }
+
+ private:
+  // counting sort of row_index by root, the order inside a root is kept
+  inline void GroupByRoot(int num_roots, const std::vector<unsigned> &group_id) {
+    const size_t nrow = row_index.size();
+    elem_.clear();
+    elem_.resize(num_roots);
+    if (group_id.size() == 0) {
+      elem_[0] = Elem(0, nrow);
+      return;
+    }
+    std::vector<size_t> cnt(num_roots + 1, 0);
+    for (size_t i = 0; i < nrow; ++i) {
+      const unsigned gid = group_id[row_index[i]];
+      utils::Assert(gid < static_cast<unsigned>(num_roots), "root index exceed setting");
+      cnt[gid + 1] += 1;
+    }
+    for (int k = 0; k < num_roots; ++k) {
+      cnt[k + 1] += cnt[k];
+      elem_[k] = Elem(cnt[k], cnt[k + 1]);
+    }
+    std::vector<bst_uint> rows(row_index);
+    for (size_t i = 0; i < nrow; ++i) {
+      row_index[cnt[group_id[rows[i]]]++] = rows[i];
+    }
+  }
+  /*! \brief range of each node, indexed by node id */
+  std::vector<Elem> elem_;
+};
+}  // namespace gbm
+}  // namespace xgboost
+#endif
@@ -4,15 +4,19 @@
  * \file xgboost_svdf_tree.hpp
  * \brief implementation of regression tree constructor, with layerwise support
  *        this file is adapted from GBRT implementation in SVDFeature project
- * \author Tianqi Chen: tqchen@apex.sjtu.edu.cn, tianqi.tchen@gmail.com 
+ * \author Tianqi Chen: tqchen@apex.sjtu.edu.cn, tianqi.tchen@gmail.com
  */
+#include <cmath>
 #include <algorithm>
 #include "tree_model.h"
+#include "row_set.h"
+#include "col_sample.h"
+#include "../utils/omp.h"
 #include "../utils/random.h"
 #include "../utils/matrix_csr.h"
 
 namespace xgboost {
-namespace gbm {                
+namespace gbm {
 // updater of rtree, allows the parameters to be stored inside, key solver
 class RTreeUpdater {
  private:
@@ -24,19 +28,275 @@ class RTreeUpdater {
   std::vector<float> &hess;
   const IFMatrix &smat;
   const std::vector<unsigned> &group_id;
+  // rows used to build the tree, in ascending order
+  const std::vector<bst_uint> &active_rows;
+  // features allowed in the split search
+  ColumnSampler &colsampler;
  public:
-  RTreeUpdater(const TreeParamTrain &pparam, 
+  RTreeUpdater(const TreeParamTrain &pparam,
                RegTree &ptree,
                std::vector<float> &pgrad,
                std::vector<float> &phess,
-               const IFMatrix &psmat, 
-               const std::vector<unsigned> &pgroup_id):
+               const IFMatrix &psmat,
+               const std::vector<unsigned> &pgroup_id,
+               const std::vector<bst_uint> &pactive_rows,
+               ColumnSampler &pcolsampler):
       param(pparam), tree(ptree), grad(pgrad), hess(phess),
-      smat(psmat), group_id(pgroup_id) {
+      smat(psmat), group_id(pgroup_id), active_rows(pactive_rows),
+      colsampler(pcolsampler) {
   }
+  /*!
+   * \brief grow the tree level by level, each level makes one pass over the sorted columns
+   * \param num_pruned number of nodes pruned during construction
+   * \return maximum depth of the tree
+   */
+  inline int DoBoost(int &num_pruned) {
+    num_pruned = 0;
+    this->InitData();
+    this->InitNewNode(qexpand);
+    for (int depth = 0; depth < param.max_depth; ++depth) {
+      this->FindSplit(depth);
+      this->ResetPosition();
+      this->UpdateQueueExpand();
+      // if nothing left to be expand, break
+      if (qexpand.size() == 0) break;
+      this->InitNewNode(qexpand);
+    }
+    // set all the rest expanding nodes to leaf, with the statistics of a leaf made in FindSplit
+    for (size_t i = 0; i < qexpand.size(); ++i) {
+      const int nid = qexpand[i];
+      const NodeEntry &e = snode[nid];
+      tree.stat(nid).loss_chg = e.best.loss_chg;
+      tree.stat(nid).sum_hess = static_cast<float>(e.stats.sum_hess);
+      tree.stat(nid).base_weight = e.weight;
+      tree.stat(nid).leaf_child_cnt = 0;
+      tree[nid].set_leaf(e.weight * param.learning_rate);
+    }
+    return tree.MaxDepth();
+  }
+
+ private:
+  // statistics of a node that is being expanded
+  struct NodeEntry {
+    /*! \brief statics for node entry */
+    GradStats stats;
+    /*! \brief loss of this node, without split */
+    float root_gain;
+    /*! \brief weight calculated related to current data */
+    float weight;
+    /*! \brief current best solution */
+    SplitEntry best;
+    NodeEntry(void) : root_gain(0.0f), weight(0.0f) {}
+  };
+  // per thread statistics of a node, used during the column scan
+  struct ThreadEntry {
+    /*! \brief statistics of the instances visited so far in current column */
+    GradStats stats;
+    /*! \brief last feature value scanned */
+    float last_fvalue;
+    /*! \brief best split found by this thread */
+    SplitEntry best;
+    ThreadEntry(void) : last_fvalue(0.0f) {}
+  };
+  // initialize temp data structure
+  inline void InitData(void) {
+    const unsigned ndata = static_cast<unsigned>(grad.size());
+    utils::Check(smat.HaveColAccess(), "exact tree maker needs column access of the data");
+    utils::Assert(group_id.size() == 0 || group_id.size() == ndata,
+                  "root index must be either empty or have same size as the data");
+    position.resize(ndata);
+    // the rows that are not sampled are marked inactive, the column scans skip them
+    std::fill(position.begin(), position.end(), -1);
+    for (size_t k = 0; k < active_rows.size(); ++k) position[active_rows[k]] = 0;
+    #pragma omp parallel for schedule(static)
+    for (unsigned i = 0; i < ndata; ++i) {
+      if (position[i] < 0) continue;
+      position[i] = group_id.size() == 0 ? 0 : static_cast<int>(group_id[i]);
+      utils::Assert(position[i] < tree.param.num_roots, "root index exceed setting");
+    }
+    int nthread = omp_get_max_threads();
+    stemp.resize(nthread, std::vector<ThreadEntry>());
+    snode.clear();
+    qexpand.clear();
+    for (int i = 0; i < tree.param.num_roots; ++i) {
+      qexpand.push_back(i);
+    }
+  }
+  // initialize the statistics of the nodes in qexpand by summing the instances in them
+  inline void InitNewNode(const std::vector<int> &qexpand) {
+    const unsigned ndata = static_cast<unsigned>(position.size());
+    const int nthread = static_cast<int>(stemp.size());
+    for (int tid = 0; tid < nthread; ++tid) {
+      stemp[tid].resize(tree.param.num_nodes, ThreadEntry());
+      for (size_t j = 0; j < qexpand.size(); ++j) {
+        stemp[tid][qexpand[j]].stats.Clear();
+      }
+    }
+    snode.resize(tree.param.num_nodes, NodeEntry());
+    #pragma omp parallel for schedule(static)
+    for (unsigned i = 0; i < ndata; ++i) {
+      const int nid = position[i];
+      if (nid < 0) continue;
+      stemp[omp_get_thread_num()][nid].stats.Add(grad[i], hess[i]);
+    }
+    for (size_t j = 0; j < qexpand.size(); ++j) {
+      const int nid = qexpand[j];
+      NodeEntry &e = snode[nid];
+      e.stats.Clear();
+      for (int tid = 0; tid < nthread; ++tid) {
+        e.stats.Add(stemp[tid][nid].stats);
+      }
+      e.root_gain = static_cast<float>(e.stats.CalcGain(param));
+      e.weight = static_cast<float>(e.stats.CalcWeight(param));
+      e.best = SplitEntry();
+    }
+  }
+  /*!
+   * \brief enumerate the split points of one sorted column, for all the nodes in qexpand at the same time,
+   *        only the present entries are visited, the statistics of the missing ones are
+   *        the node statistics minus the visited ones
+   * \param it column iterator, forward or backward
+   * \param fid feature index
+   * \param temp per thread statistics
+   * \param default_left whether the missing values go to left; when the column is scanned forward,
+   *        the visited instances go to left and the missing ones to right, and the opposite when backward
+   */
+  template<typename Iter>
+  inline void EnumerateSplit(Iter it, unsigned fid, std::vector<ThreadEntry> &temp, bool default_left) {
+    const float dir = default_left ? -1.0f : 1.0f;
+    for (size_t j = 0; j < qexpand.size(); ++j) {
+      temp[qexpand[j]].stats.Clear();
+    }
+    GradStats c;
+    while (it.Next()) {
+      const int nid = position[it.rindex()];
+      if (nid < 0) continue;
+      const bst_float fvalue = it.fvalue();
+      ThreadEntry &e = temp[nid];
+      if (!e.stats.Empty() && std::fabs(fvalue - e.last_fvalue) > rt_2eps &&
+          e.stats.sum_hess >= param.min_child_weight) {
+        c.SetSubstract(snode[nid].stats, e.stats);
+        if (c.sum_hess >= param.min_child_weight) {
+          const double loss_chg = e.stats.CalcGain(param) + c.CalcGain(param) - snode[nid].root_gain;
+          e.best.Update(static_cast<float>(loss_chg), fid, (fvalue + e.last_fvalue) * 0.5f, default_left);
+        }
+      }
+      e.stats.Add(grad[it.rindex()], hess[it.rindex()]);
+      e.last_fvalue = fvalue;
+    }
+    // all the present values go to one side, missing values go to the other side
+    for (size_t j = 0; j < qexpand.size(); ++j) {
+      const int nid = qexpand[j];
+      ThreadEntry &e = temp[nid];
+      if (e.stats.Empty() || e.stats.sum_hess < param.min_child_weight) continue;
+      c.SetSubstract(snode[nid].stats, e.stats);
+      if (c.sum_hess >= param.min_child_weight) {
+        const double loss_chg = e.stats.CalcGain(param) + c.CalcGain(param) - snode[nid].root_gain;
+        e.best.Update(static_cast<float>(loss_chg), fid, e.last_fvalue + dir * rt_eps, default_left);
+      }
+    }
+  }
+  // find splits for all the nodes in qexpand, one pass over the columns
+  inline void FindSplit(int depth) {
+    const std::vector<unsigned> &fset = colsampler.LevelFeatures(depth);
+    const int nthread = static_cast<int>(stemp.size());
+    for (int tid = 0; tid < nthread; ++tid) {
+      for (size_t j = 0; j < qexpand.size(); ++j) {
+        stemp[tid][qexpand[j]].best = SplitEntry();
+      }
+    }
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int k = 0; k < static_cast<int>(fset.size()); ++k) {
+      const unsigned fid = fset[k];
+      std::vector<ThreadEntry> &temp = stemp[omp_get_thread_num()];
+      // default_direction, 0: learn, 1: left, 2: right
+      if (param.default_direction != 1) {
+        this->EnumerateSplit(smat.GetSortedCol(fid), fid, temp, false);
+      }
+      if (param.default_direction != 2) {
+        this->EnumerateSplit(smat.GetReverseSortedCol(fid), fid, temp, true);
+      }
+    }
+    // reduce the best split found by each thread, and set the tree nodes
+    for (size_t j = 0; j < qexpand.size(); ++j) {
+      const int nid = qexpand[j];
+      NodeEntry &e = snode[nid];
+      for (int tid = 0; tid < nthread; ++tid) {
+        e.best.Update(stemp[tid][nid].best);
+      }
+      tree.stat(nid).loss_chg = e.best.loss_chg;
+      tree.stat(nid).sum_hess = static_cast<float>(e.stats.sum_hess);
+      tree.stat(nid).base_weight = e.weight;
+      tree.stat(nid).leaf_child_cnt = 0;
+      // min_split_loss is applied by the pruner after the tree is grown
+      if (e.best.loss_chg > rt_eps) {
+        tree.AddChilds(nid);
+        tree[nid].set_split(e.best.split_index(), e.best.split_value, e.best.default_left());
+      } else {
+        tree[nid].set_leaf(e.weight * param.learning_rate);
+      }
+    }
+  }
+  // move the instances to the children of the nodes that are split
+  inline void ResetPosition(void) {
+    const unsigned ndata = static_cast<unsigned>(position.size());
+    // first move everything to default direction, finished instances are marked by ~nid
+    #pragma omp parallel for schedule(static)
+    for (unsigned i = 0; i < ndata; ++i) {
+      const int nid = position[i];
+      if (nid < 0) continue;
+      if (tree[nid].is_leaf()) {
+        position[i] = ~nid;
+      } else {
+        position[i] = tree[nid].cdefault();
+      }
+    }
+    // collect the features used by this level
+    std::vector<unsigned> fsplits;
+    for (size_t j = 0; j < qexpand.size(); ++j) {
+      const int nid = qexpand[j];
+      if (!tree[nid].is_leaf()) fsplits.push_back(tree[nid].split_index());
+    }
+    std::sort(fsplits.begin(), fsplits.end());
+    fsplits.resize(std::unique(fsplits.begin(), fsplits.end()) - fsplits.begin());
+    // then correct the instances whose split feature is present
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int k = 0; k < static_cast<int>(fsplits.size()); ++k) {
+      const unsigned fid = fsplits[k];
+      for (IFMatrix::ColIter it = smat.GetSortedCol(fid); it.Next();) {
+        const bst_uint ridx = it.rindex();
+        const int nid = position[ridx];
+        if (nid < 0) continue;
+        const int pid = tree[nid].parent();
+        if (tree[pid].split_index() == fid) {
+          position[ridx] = it.fvalue() < tree[pid].split_cond() ? tree[pid].cleft() : tree[pid].cright();
+        }
+      }
+    }
+  }
+  // collect the new nodes to be expanded
+  inline void UpdateQueueExpand(void) {
+    std::vector<int> newnodes;
+    for (size_t j = 0; j < qexpand.size(); ++j) {
+      const int nid = qexpand[j];
+      if (!tree[nid].is_leaf()) {
+        newnodes.push_back(tree[nid].cleft());
+        newnodes.push_back(tree[nid].cright());
+      }
+    }
+    qexpand = newnodes;
+  }
+
+ private:
+  /*! \brief node id of each instance, negative value means the instance is no longer active */
+  std::vector<int> position;
+  /*! \brief statistics of each node */
+  std::vector<NodeEntry> snode;
+  /*! \brief per thread statistics used in split finding, indexed by node id */
+  std::vector< std::vector<ThreadEntry> > stemp;
+  /*! \brief queue of nodes to be expanded */
+  std::vector<int> qexpand;
 };
 }  // namespace gbm
 }  // namespace xgboost
 #endif
-
-
@@ -0,0 +1,84 @@
+#ifndef XGBOOST_TREE_THREAD_WORKSPACE_H
+#define XGBOOST_TREE_THREAD_WORKSPACE_H
+/*!
+ * \file thread_workspace.h
+ * \brief per thread scratch space of RegTreeTrainer, owned by the model and shared by all its
+ *        trees across the boosting rounds, so the buffers reach their working size once and are reused
+ */
+#include <vector>
+#include <new>
+#include "../utils/utils.h"
+#include "../utils/omp.h"
+#include "../utils/aligned.h"
+#include "tree_model.h"
+#include "hist_util.h"
+
+namespace xgboost {
+namespace gbm {
+/*!
+ * \brief scratch space of one thread,
+ *        dense feature vector used in prediction and buffers used in tree construction,
+ *        each entry and each buffer starts on its own cache line
+ */
+struct TreeThreadEntry {
+  /*! \brief dense feature vector */
+  std::vector< float, utils::AlignedAllocator<float> > feat;
+  /*! \brief whether the feature is missing */
+  std::vector< bool, utils::AlignedAllocator<bool> > funknown;
+  /*! \brief rows that go to left child */
+  std::vector< bst_uint, utils::AlignedAllocator<bst_uint> > left;
+  /*! \brief rows that go to right child */
+  std::vector< bst_uint, utils::AlignedAllocator<bst_uint> > right;
+  /*! \brief histogram of the thread, reduced into the histogram of a node */
+  std::vector< GradStats, utils::AlignedAllocator<GradStats> > hist;
+  /*! \brief statistics of the nodes accumulated by the thread */
+  std::vector< GradStats, utils::AlignedAllocator<GradStats> > stats;
+  /*! \brief histogram of the thread, when the gradients are quantized */
+  std::vector< QuantStats, utils::AlignedAllocator<QuantStats> > qhist;
+  /*! \brief statistics of the nodes accumulated by the thread, when the gradients are quantized */
+  std::vector< QuantStats, utils::AlignedAllocator<QuantStats> > qstats;
+};
+
+/*! \brief one TreeThreadEntry per OpenMP thread */
+class ThreadWorkspace {
+ public:
+  ThreadWorkspace(void) {}
+  ~ThreadWorkspace(void) {
+    for (size_t i = 0; i < entry_.size(); ++i) {
+      entry_[i]->~TreeThreadEntry();
+      utils::AlignedFree(entry_[i]);
+    }
+  }
+  /*!
+   * \brief make sure there is an entry for each of the omp_get_max_threads() threads,
+   *        existing entries keep their buffers
+   */
+  inline void Init(void) {
+    const size_t nthread = static_cast<size_t>(omp_get_max_threads());
+    while (entry_.size() < nthread) {
+      void *ptr = utils::AlignedMalloc(utils::AlignedSize(sizeof(TreeThreadEntry)));
+      entry_.push_back(new (ptr) TreeThreadEntry());
+    }
+  }
+  /*! \return number of entries */
+  inline size_t Size(void) const {
+    return entry_.size();
+  }
+  /*! \brief scratch space of thread tid */
+  inline TreeThreadEntry &operator[](size_t tid) {
+    return *entry_[tid];
+  }
+  inline const TreeThreadEntry &operator[](size_t tid) const {
+    return *entry_[tid];
+  }
+
+ private:
+  // the entries own their buffers, the workspace is not copyable
+  ThreadWorkspace(const ThreadWorkspace &other);
+  ThreadWorkspace &operator=(const ThreadWorkspace &other);
+  /*! \brief entry of each thread, each one in its own cache lines */
+  std::vector<TreeThreadEntry*> entry_;
+};
+}  // namespace gbm
+}  // namespace xgboost
+#endif
@@ -23,6 +23,9 @@ namespace gbm {
 };
 #include "../utils/fmap.h"
 #include "svdf_tree.hpp"
+#include "hist_tree.hpp"
+#include "approx_tree.hpp"
+#include "tree_prune.hpp"
 //#include "xgboost_col_treemaker.hpp"
 //#include "xgboost_row_treemaker.hpp"
 
@@ -33,9 +36,9 @@ namespace gbm {
 class RegTreeTrainer : public IGradBooster {
  public:
   RegTreeTrainer(void) { 
-    silent = 0; tree_maker = 1; 
-    // normally we won't have more than 64 OpenMP threads
-    threadtemp.resize(64, ThreadEntry());
+    silent = 0; tree_maker = 0; 
+    hcache = &own_hcache;
+    threadtemp = NULL;
   }
   virtual ~RegTreeTrainer(void) {}
  public:
@@ -44,6 +47,7 @@ class RegTreeTrainer : public IGradBooster {
     if (!strcmp(name, "tree_maker")) tree_maker = atoi(val);
     param.SetParam(name, val);
     constrain.SetParam(name, val);
+    categorical.SetParam(name, val);
     tree.param.SetParam(name, val);
   }
   virtual void LoadModel(utils::IStream &fi) {
@@ -55,6 +59,12 @@ class RegTreeTrainer : public IGradBooster {
   virtual void InitModel(void) {
     tree.InitModel();
   }
+  virtual void SetDataCache(HistIndexCache *cache) {
+    hcache = cache != NULL ? cache : &own_hcache;
+  }
+  virtual void SetThreadWorkspace(ThreadWorkspace *ws) {
+    threadtemp = ws;
+  }
  public:
   virtual void DoBoost(std::vector<float> &grad, 
                        std::vector<float> &hess,
@@ -64,23 +74,134 @@ class RegTreeTrainer : public IGradBooster {
     if (!silent) {
       printf("\nbuild GBRT with %u instances\n", (unsigned)grad.size());
     }
+    if (param.nthread != 0) omp_set_num_threads(param.nthread);
+    utils::Assert(threadtemp != NULL, "RegTreeTrainer: thread workspace not set");
+    threadtemp->Init();
+    // the rows are only needed while the tree is built
+    std::vector<bst_uint> active_rows;
+    this->InitActiveRows(grad, hess, active_rows);
+    // the features banned by the constrain are never drawn
+    colsampler.InitTree(static_cast<unsigned>(smat.NumCol()), constrain,
+                        param.colsample_bytree, param.colsample_bylevel,
+                        param.colsample_bytree < 1.0f || param.colsample_bylevel < 1.0f ?
+                        random::NextSeed() : 0);
     int num_pruned;
-    switch (tree_maker) {
+    switch (param.tree_method >= 0 ? param.tree_method : tree_maker) {
       case 0: {
-        utils::Assert(!constrain.HasConstrain(), "tree maker 0 does not support constrain");
-        RTreeUpdater updater(param, tree, grad, hess, smat, root_index);
-        //tree.param.max_depth = updater.do_boost( num_pruned );
+        utils::Assert(param.grow_policy == 0, "tree maker 0 only supports grow_policy=depthwise");
+        utils::Check(!categorical.HasCategorical(), "tree maker 0 does not support categorical features");
+        RTreeUpdater updater(param, tree, grad, hess, smat, root_index, active_rows, colsampler);
+        tree.param.max_depth = updater.DoBoost(num_pruned);
         break;
       }
+      case 2: {
+        if (param.use_quantized_grad != 0) {
+          HistTreeUpdater<QuantGradient> updater(param, tree, grad, hess, smat, root_index, active_rows,
+                                                 colsampler, categorical, *threadtemp, *hcache);
+          tree.param.max_depth = updater.DoBoost(num_pruned);
+        } else {
+          HistTreeUpdater<FloatGradient> updater(param, tree, grad, hess, smat, root_index, active_rows,
+                                                 colsampler, categorical, *threadtemp, *hcache);
+          tree.param.max_depth = updater.DoBoost(num_pruned);
+        }
+        break;
+      }
+      case 3: {
+        utils::Assert(param.grow_policy == 0, "tree maker 3 only supports grow_policy=depthwise");
+        utils::Check(!categorical.HasCategorical(), "tree maker 3 does not support categorical features");
+        ApproxTreeUpdater updater(param, tree, grad, hess, smat, root_index, active_rows,
+                                  colsampler, *threadtemp);
+        tree.param.max_depth = updater.DoBoost(num_pruned);
+        break;
+      }
+      default: utils::Error("unknown tree maker");
+    }
+    if (param.min_split_loss > 0.0f) {
+      TreePruner pruner(param, tree);
+      // the pruned slots stay in the tree until it is saved, SaveModel compacts a copy,
+      // and the inference layouts only copy the nodes reachable from the roots
+      num_pruned += pruner.DoPrune();
+      tree.param.max_depth = tree.MaxDepth();
+    }
+    if (!silent) {
+      printf("tree train end, %d roots, %d extra nodes, %d pruned nodes ,max_depth=%d\n",
+             tree.param.num_roots, tree.num_extra_nodes(), num_pruned, tree.param.max_depth);
     }
   }            
+  virtual void Refresh(const std::vector<float> &grad,
+                       const std::vector<float> &hess,
+                       const IFMatrix &smat,
+                       const std::vector<unsigned> &root_index) {
+    utils::Assert(grad.size() < UINT_MAX, "number of instance exceed what we can handle");
+    if (param.nthread != 0) omp_set_num_threads(param.nthread);
+    utils::Assert(threadtemp != NULL, "RegTreeTrainer: thread workspace not set");
+    threadtemp->Init();
+    const int nthread = omp_get_max_threads();
+    const int num_nodes = tree.param.num_nodes;
+    for (int tid = 0; tid < nthread; ++tid) {
+      std::vector< GradStats, utils::AlignedAllocator<GradStats> > &s = (*threadtemp)[tid].stats;
+      s.resize(num_nodes);
+      std::fill(s.begin(), s.end(), GradStats());
+    }
+    // route every instance from its root to its leaf, adding its gradient to the nodes on the path
+    const long ndata = static_cast<long>(grad.size());
+    #pragma omp parallel for schedule(static)
+    for (long i = 0; i < ndata; ++i) {
+      const bst_uint ridx = static_cast<bst_uint>(i);
+      TreeThreadEntry &t = (*threadtemp)[omp_get_thread_num()];
+      int nid = root_index.size() == 0 ? 0 : static_cast<int>(root_index[ridx]);
+      utils::Assert(nid < tree.param.num_roots, "root index exceed setting");
+      this->FillFeat(smat, ridx, t);
+      t.stats[nid].Add(grad[ridx], hess[ridx]);
+      while (!tree[nid].is_leaf()) {
+        const unsigned fid = tree[nid].split_index();
+        nid = tree.GetNext(nid, t.feat[fid], t.funknown[fid]);
+        t.stats[nid].Add(grad[ridx], hess[ridx]);
+      }
+      this->DropFeat(smat, ridx, t);
+    }
+    std::vector< GradStats, utils::AlignedAllocator<GradStats> > &stats = (*threadtemp)[0].stats;
+    for (int tid = 1; tid < nthread; ++tid) {
+      for (int nid = 0; nid < num_nodes; ++nid) {
+        stats[nid].Add((*threadtemp)[tid].stats[nid]);
+      }
+    }
+    for (int nid = 0; nid < num_nodes; ++nid) {
+      // deleted slots are marked as roots beyond num_roots
+      if (nid >= tree.param.num_roots && tree[nid].is_root()) continue;
+      RTreeNodeStat &st = tree.stat(nid);
+      st.sum_hess = static_cast<float>(stats[nid].sum_hess);
+      st.base_weight = static_cast<float>(stats[nid].CalcWeight(param));
+      if (tree[nid].is_leaf()) {
+        tree[nid].set_leaf(st.base_weight * param.learning_rate);
+      } else {
+        st.loss_chg = static_cast<float>(stats[tree[nid].cleft()].CalcGain(param) +
+                                         stats[tree[nid].cright()].CalcGain(param) -
+                                         stats[nid].CalcGain(param));
+      }
+    }
+    if (!silent) {
+      printf("tree refresh end, %u instances, %d roots, %d extra nodes\n",
+             static_cast<unsigned>(grad.size()), tree.param.num_roots, tree.num_extra_nodes());
+    }
+  }
+  virtual const RegTree *GetTree(void) const {
+    return &tree;
+  }
   virtual float Predict(const IFMatrix &fmat, bst_uint ridx, unsigned gid = 0) {     
-    return 0.0f;  
+    const size_t tid = static_cast<size_t>(omp_get_thread_num());
+    utils::Assert(threadtemp != NULL && tid < threadtemp->Size(), "RegTreeTrainer: not enough thread scratch");
+    TreeThreadEntry &t = (*threadtemp)[tid];
+    this->FillFeat(fmat, ridx, t);
+    const int nid = this->GetLeafIndex(t.feat, t.funknown, gid);
+    this->DropFeat(fmat, ridx, t);
+    return tree[nid].leaf_value();
   }
   virtual float Predict(const std::vector<float> &feat, 
                         const std::vector<bool> &funknown,
                         unsigned gid = 0) {
-    return 0.0f; 
+    utils::Assert(feat.size() == funknown.size(), "Predict: size of feat and funknown do not match");
+    return tree[this->GetLeafIndex(feat, funknown, gid)].leaf_value();
   }            
 
  private:
@@ -93,12 +214,77 @@ class RegTreeTrainer : public IGradBooster {
   int tree_maker;
   // feature constrain
   utils::FeatConstrain constrain;  
+  // categorical features
+  utils::FeatCategorical categorical;
+ private:
+  /*!
+   * \brief draw the rows used to build this tree,
+   *        gradient based sampling also rescales grad and hess of the drawn rows
+   * \param active_rows output, indices of the drawn rows in ascending order
+   */
+  inline void InitActiveRows(std::vector<float> &grad, std::vector<float> &hess,
+                             std::vector<bst_uint> &active_rows) const {
+    const size_t ndata = grad.size();
+    if (param.sampling_method == 1) {
+      utils::Check(param.top_rate >= 0.0f && param.other_rate > 0.0f &&
+                   param.top_rate + param.other_rate <= 1.0f,
+                   "goss needs top_rate >= 0, other_rate > 0 and top_rate + other_rate <= 1");
+      SampleRowsGOSS(grad, hess, param.top_rate, param.other_rate, random::NextSeed(), active_rows);
+    } else if (param.subsample < 1.0f) {
+      utils::Check(param.subsample > 0.0f, "subsample must be in (0, 1]");
+      SampleRows(ndata, param.subsample, random::NextSeed(), active_rows);
+    } else {
+      active_rows.resize(ndata);
+      for (size_t i = 0; i < ndata; ++i) active_rows[i] = static_cast<bst_uint>(i);
+    }
+  }
+  /*!
+   * \brief get the leaf reached by an instance from root gid
+   * \param feat dense feature vector of the instance
+   * \param funknown whether each feature is missing, features beyond its size are missing
+   */
+  template<typename TFeat, typename TUnknown>
+  inline int GetLeafIndex(const TFeat &feat, const TUnknown &funknown, unsigned gid) const {
+    utils::Assert(gid < static_cast<unsigned>(tree.param.num_roots), "root index exceed setting");
+    int nid = static_cast<int>(gid);
+    while (!tree[nid].is_leaf()) {
+      const unsigned fid = tree[nid].split_index();
+      const bool unknown = fid >= funknown.size() || funknown[fid];
+      nid = tree.GetNext(nid, unknown ? 0.0f : feat[fid], unknown);
+    }
+    return nid;
+  }
+  /*!
+   * \brief load row ridx into the dense feature vector of t,
+   *        the vector is sized to the number of features of the tree at first use
+   */
+  inline void FillFeat(const IFMatrix &fmat, bst_uint ridx, TreeThreadEntry &t) const {
+    const size_t nfeat = static_cast<size_t>(tree.param.num_feature);
+    if (t.feat.size() != nfeat) {
+      t.feat.resize(nfeat); t.funknown.resize(nfeat);
+      std::fill(t.funknown.begin(), t.funknown.end(), true);
+    }
+    for (IFMatrix::RowIter it = fmat.GetRow(ridx); it.Next();) {
+      if (it.findex() < nfeat) {
+        t.feat[it.findex()] = it.fvalue(); t.funknown[it.findex()] = false;
+      }
+    }
+  }
+  /*! \brief mark the features of row ridx missing again, only the slots set by FillFeat are touched */
+  inline void DropFeat(const IFMatrix &fmat, bst_uint ridx, TreeThreadEntry &t) const {
+    const size_t nfeat = t.funknown.size();
+    for (IFMatrix::RowIter it = fmat.GetRow(ridx); it.Next();) {
+      if (it.findex() < nfeat) t.funknown[it.findex()] = true;
+    }
+  }
  private:
-  struct ThreadEntry {
-    std::vector<float> feat;
-    std::vector<bool> funknown;
-  };
-  std::vector<ThreadEntry> threadtemp;
+  // per thread scratch of the model, shared by all the boosters, see SetThreadWorkspace
+  ThreadWorkspace *threadtemp;
+  // quantized matrix used by the hist maker, the one of the model or own_hcache
+  HistIndexCache *hcache;
+  HistIndexCache own_hcache;
+  // features used by the current tree and its levels
+  ColumnSampler colsampler;
 };
 }  // namespace gbm
 }  // namespace xgboost
@@ -0,0 +1,298 @@
+#ifndef XGBOOST_TREE_TREE_ENSEMBLE_H
+#define XGBOOST_TREE_TREE_ENSEMBLE_H
+/*!
+ * \file tree_ensemble.h
+ * \brief inference only layout of a tree ensemble: the nodes of all the trees packed into one
+ *        array of 12 byte nodes, the two children of a node are adjacent, leaf values are kept apart
+ */
+#include <vector>
+#include <utility>
+#include "../utils/utils.h"
+#include "tree_model.h"
+
+// lockstep traversal kernels for x86 compilers that can target AVX2/AVX-512 per function,
+// the rest of the code is built with the flags of the Makefile and picks a kernel at runtime
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(XGBOOST_NO_SIMD)
+#define XGBOOST_TREE_SIMD 1
+#include <immintrin.h>
+#endif
+
+namespace xgboost {
+namespace gbm {
+/*! \brief a row of a dense feature block, indexed like the feature vectors given to Predict */
+template<typename T>
+struct DenseRow {
+  const T *data;
+  size_t len;
+  DenseRow(const T *data, size_t len) : data(data), len(len) {}
+  inline size_t size(void) const {
+    return len;
+  }
+  inline T operator[](size_t i) const {
+    return data[i];
+  }
+};
+/*! \brief flattened copy of the trees of a model, used for prediction only */
+class FlatTreeEnsemble {
+ public:
+  /*! \brief instruction set of the block traversal */
+  enum SIMDLevel {
+    kScalar = 0,
+    kAVX2 = 1,
+    kAVX512 = 2
+  };
+  /*! \brief node of the packed layout */
+  struct Node {
+    /*! \brief split feature index, bit 31: default left, bit 30: categorical split */
+    unsigned sindex;
+    /*! \brief split condition, or start of the category set in cat_bits for a categorical split */
+    union {
+      float split_cond;
+      unsigned cat_begin;
+    } info;
+    /*! \brief position of the left child, the right child follows it; ~leaf index for a leaf */
+    int cleft;
+  };
+  FlatTreeEnsemble(void) {
+    // the simd kernels read the three words of a node by gathers
+    utils::Assert(sizeof(Node) == 3 * sizeof(int), "FlatTreeEnsemble: unexpected node size");
+    this->Clear();
+  }
+  /*! \brief remove all the trees */
+  inline void Clear(void) {
+    nodes_.clear(); leaf_value_.clear(); cat_bits_.clear();
+    has_categorical_ = false;
+    roots_.clear(); root_ptr_.clear(); root_ptr_.push_back(0);
+  }
+  /*! \return number of trees packed */
+  inline size_t NumTree(void) const {
+    return root_ptr_.size() - 1;
+  }
+  /*!
+   * \brief append a tree, its nodes are renumbered level by level,
+   *        deleted node slots of the tree are not copied
+   */
+  inline void AddTree(const RegTree &tree) {
+    // pairs of (node in tree, position in nodes_) waiting to be copied, children are given
+    // their two adjacent positions when the parent is copied
+    std::vector< std::pair<int, int> > queue;
+    for (int rid = 0; rid < tree.param.num_roots; ++rid) {
+      roots_.push_back(static_cast<int>(nodes_.size()));
+      queue.push_back(std::make_pair(rid, static_cast<int>(nodes_.size())));
+      nodes_.push_back(Node());
+    }
+    for (size_t qi = 0; qi < queue.size(); ++qi) {
+      const int nid = queue[qi].first;
+      const RegTree::Node &src = tree[nid];
+      Node &dst = nodes_[queue[qi].second];
+      if (src.is_leaf()) {
+        dst.sindex = 0; dst.info.split_cond = 0.0f;
+        dst.cleft = ~static_cast<int>(leaf_value_.size());
+        leaf_value_.push_back(src.leaf_value());
+        continue;
+      }
+      dst.sindex = src.split_index();
+      if (src.default_left()) dst.sindex |= 1U << 31;
+      if (src.is_categorical()) {
+        dst.sindex |= 1U << 30;
+        has_categorical_ = true;
+        const unsigned *bits = tree.CategorySet(nid);
+        dst.info.cat_begin = static_cast<unsigned>(cat_bits_.size());
+        cat_bits_.insert(cat_bits_.end(), bits, bits + 1 + bits[0]);
+      } else {
+        dst.info.split_cond = src.split_cond();
+      }
+      const int cleft = static_cast<int>(nodes_.size());
+      dst.cleft = cleft;
+      // dst is not used below, push_back may move the array
+      queue.push_back(std::make_pair(src.cleft(), cleft));
+      queue.push_back(std::make_pair(src.cright(), cleft + 1));
+      nodes_.push_back(Node()); nodes_.push_back(Node());
+    }
+    root_ptr_.push_back(static_cast<unsigned>(roots_.size()));
+  }
+  /*! \return the widest block traversal the running CPU supports */
+  inline static int DetectSIMD(void) {
+#ifdef XGBOOST_TREE_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return kAVX512;
+    if (__builtin_cpu_supports("avx2")) return kAVX2;
+#endif
+    return kScalar;
+  }
+  /*!
+   * \brief add the prediction of tree tid for a block of rows to psum, rows of the block
+   *        go through the tree together, 16 or 8 at a time when simd allows it
+   * \param fvalue dense features of the rows, feature j of row r is fvalue[r * stride + j]
+   * \param missing 1 when the feature is missing, same layout as fvalue
+   * \param stride number of features of each row, features beyond it are missing
+   * \param nrow number of rows
+   * \param gid root of each row, NULL means root 0 for all rows
+   * \param psum sum of each row
+   * \param simd instruction set to use, at most DetectSIMD()
+   */
+  inline void PredictBlock(size_t tid, const float *fvalue, const int *missing, size_t stride,
+                           size_t nrow, const unsigned *gid, float *psum, int simd) const {
+    size_t r = 0;
+#ifdef XGBOOST_TREE_SIMD
+    // the kernels do not handle categorical splits
+    if (!has_categorical_) {
+      if (simd >= kAVX512) {
+        for (; r + 16 <= nrow; r += 16) {
+          this->PredictAVX512(tid, fvalue + r * stride, missing + r * stride, stride,
+                              gid == NULL ? NULL : gid + r, psum + r);
+        }
+      }
+      if (simd >= kAVX2) {
+        for (; r + 8 <= nrow; r += 8) {
+          this->PredictAVX2(tid, fvalue + r * stride, missing + r * stride, stride,
+                            gid == NULL ? NULL : gid + r, psum + r);
+        }
+      }
+    }
+#endif
+    for (; r < nrow; ++r) {
+      psum[r] += this->Predict(tid, DenseRow<float>(fvalue + r * stride, stride),
+                               DenseRow<int>(missing + r * stride, stride),
+                               gid == NULL ? 0 : gid[r]);
+    }
+  }
+  /*!
+   * \brief predict the value of tree tid for an instance from root gid
+   * \param feat dense feature vector of the instance
+   * \param funknown whether each feature is missing, features beyond its size are missing
+   */
+  template<typename TFeat, typename TUnknown>
+  inline float Predict(size_t tid, const TFeat &feat, const TUnknown &funknown, unsigned gid) const {
+    utils::Assert(root_ptr_[tid] + gid < root_ptr_[tid + 1], "root index exceed setting");
+    const Node *nodes = &nodes_[0];
+    int nid = roots_[root_ptr_[tid] + gid];
+    while (nodes[nid].cleft >= 0) {
+      const Node &n = nodes[nid];
+      const unsigned fid = n.sindex & ((1U << 30) - 1U);
+      if (fid >= funknown.size() || funknown[fid]) {
+        nid = n.cleft + ((n.sindex >> 31) != 0 ? 0 : 1);
+      } else if (((n.sindex >> 30) & 1U) != 0) {
+        nid = n.cleft + (this->CategoryGoLeft(n.info.cat_begin, feat[fid]) ? 0 : 1);
+      } else {
+        nid = n.cleft + (feat[fid] < n.info.split_cond ? 0 : 1);
+      }
+    }
+    return leaf_value_[~nodes[nid].cleft];
+  }
+
+ private:
+#ifdef XGBOOST_TREE_SIMD
+  // first node of each of the rows of a block
+  inline void StartNodes(size_t tid, const unsigned *gid, size_t n, int *out) const {
+    for (size_t r = 0; r < n; ++r) {
+      const unsigned g = gid == NULL ? 0 : gid[r];
+      utils::Assert(root_ptr_[tid] + g < root_ptr_[tid + 1], "root index exceed setting");
+      out[r] = roots_[root_ptr_[tid] + g];
+    }
+  }
+  // 8 rows through tree tid, the nodes are read by gathers of the 3 words of each node
+  __attribute__((target("avx2")))
+  inline void PredictAVX2(size_t tid, const float *fvalue, const int *missing, size_t stride,
+                          const unsigned *gid, float *psum) const {
+    int start[8], leaf[8];
+    this->StartNodes(tid, gid, 8, start);
+    const int *base = reinterpret_cast<const int*>(&nodes_[0]);
+    const __m256i one = _mm256_set1_epi32(1), three = _mm256_set1_epi32(3);
+    const __m256i fmask = _mm256_set1_epi32((1 << 30) - 1);
+    const __m256i vstride = _mm256_set1_epi32(static_cast<int>(stride));
+    const __m256i row_off = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), vstride);
+    __m256i nid = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(start));
+    __m256i cleft;
+    while (true) {
+      const __m256i pos = _mm256_mullo_epi32(nid, three);
+      cleft = _mm256_i32gather_epi32(base + 2, pos, 4);
+      // rows at a leaf stay where they are
+      const __m256i active = _mm256_cmpgt_epi32(cleft, _mm256_set1_epi32(-1));
+      if (_mm256_movemask_epi8(active) == 0) break;
+      const __m256i sindex = _mm256_i32gather_epi32(base, pos, 4);
+      const __m256 cond = _mm256_i32gather_ps(reinterpret_cast<const float*>(base + 1), pos, 4);
+      const __m256i fid = _mm256_and_si256(sindex, fmask);
+      const __m256i inrange = _mm256_and_si256(active, _mm256_cmpgt_epi32(vstride, fid));
+      const __m256i foff = _mm256_add_epi32(row_off, fid);
+      const __m256 fv = _mm256_mask_i32gather_ps(_mm256_setzero_ps(), fvalue, foff,
+                                                 _mm256_castsi256_ps(inrange), 4);
+      const __m256i miss = _mm256_mask_i32gather_epi32(one, missing, foff, inrange, 4);
+      const __m256i is_miss = _mm256_cmpeq_epi32(miss, one);
+      // default left is the sign bit of sindex
+      const __m256i dleft = _mm256_cmpgt_epi32(_mm256_setzero_si256(), sindex);
+      const __m256i vleft = _mm256_castps_si256(_mm256_cmp_ps(fv, cond, _CMP_LT_OQ));
+      const __m256i left = _mm256_blendv_epi8(vleft, dleft, is_miss);
+      // left: cleft + 0, right: cleft + 1, left is all ones
+      const __m256i next = _mm256_add_epi32(_mm256_add_epi32(cleft, one), left);
+      nid = _mm256_blendv_epi8(nid, next, active);
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(leaf), cleft);
+    for (int r = 0; r < 8; ++r) psum[r] += leaf_value_[~leaf[r]];
+  }
+  // 16 rows through tree tid, same steps as PredictAVX2 with mask registers
+  __attribute__((target("avx512f")))
+  inline void PredictAVX512(size_t tid, const float *fvalue, const int *missing, size_t stride,
+                            const unsigned *gid, float *psum) const {
+    int start[16], leaf[16];
+    this->StartNodes(tid, gid, 16, start);
+    const int *base = reinterpret_cast<const int*>(&nodes_[0]);
+    const __m512i one = _mm512_set1_epi32(1), three = _mm512_set1_epi32(3);
+    const __m512i fmask = _mm512_set1_epi32((1 << 30) - 1);
+    const __m512i vstride = _mm512_set1_epi32(static_cast<int>(stride));
+    const __m512i row_off = _mm512_mullo_epi32(
+        _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15), vstride);
+    __m512i nid = _mm512_loadu_si512(start);
+    // the unmasked gathers leave their source operand undefined, which gcc reports as
+    // uninitialized, so all the gathers are masked ones over a zeroed source
+    const __mmask16 all = static_cast<__mmask16>(0xFFFF);
+    const __m512i izero = _mm512_setzero_si512();
+    const __m512 fzero = _mm512_setzero_ps();
+    __m512i cleft;
+    while (true) {
+      const __m512i pos = _mm512_mullo_epi32(nid, three);
+      cleft = _mm512_mask_i32gather_epi32(izero, all, pos, base + 2, 4);
+      const __mmask16 active = _mm512_cmpgt_epi32_mask(cleft, _mm512_set1_epi32(-1));
+      if (active == 0) break;
+      const __m512i sindex = _mm512_mask_i32gather_epi32(izero, all, pos, base, 4);
+      const __m512 cond = _mm512_mask_i32gather_ps(fzero, all, pos,
+                                                   reinterpret_cast<const float*>(base + 1), 4);
+      const __m512i fid = _mm512_and_si512(sindex, fmask);
+      const __mmask16 inrange = active & _mm512_cmpgt_epi32_mask(vstride, fid);
+      const __m512i foff = _mm512_add_epi32(row_off, fid);
+      const __m512 fv = _mm512_mask_i32gather_ps(fzero, inrange, foff, fvalue, 4);
+      const __m512i miss = _mm512_mask_i32gather_epi32(one, inrange, foff, missing, 4);
+      const __mmask16 is_miss = _mm512_cmpeq_epi32_mask(miss, one);
+      const __mmask16 dleft = _mm512_cmplt_epi32_mask(sindex, izero);
+      const __mmask16 vleft = _mm512_cmp_ps_mask(fv, cond, _CMP_LT_OQ);
+      const __mmask16 left = (is_miss & dleft) | (~is_miss & vleft);
+      const __m512i next = _mm512_mask_add_epi32(cleft, static_cast<__mmask16>(~left), cleft, one);
+      nid = _mm512_mask_mov_epi32(nid, active, next);
+    }
+    _mm512_storeu_si512(leaf, cleft);
+    for (int r = 0; r < 16; ++r) psum[r] += leaf_value_[~leaf[r]];
+  }
+#endif
+  // same rule as TreeModel::CategoryGoLeft
+  inline bool CategoryGoLeft(unsigned cat_begin, float fvalue) const {
+    if (!(fvalue >= 0.0f)) return false;
+    const unsigned *bits = &cat_bits_[cat_begin];
+    const unsigned cat = static_cast<unsigned>(fvalue);
+    return cat < bits[0] * 32U && ((bits[1 + (cat >> 5)] >> (cat & 31U)) & 1U) != 0;
+  }
+  /*! \brief whether some tree has a categorical split */
+  bool has_categorical_;
+  /*! \brief nodes of all the trees */
+  std::vector<Node> nodes_;
+  /*! \brief leaf values, indexed by ~cleft of the leaf nodes */
+  std::vector<float> leaf_value_;
+  /*! \brief category sets of the categorical splits, each one is its number of words followed by the words */
+  std::vector<unsigned> cat_bits_;
+  /*! \brief position of each root in nodes_ */
+  std::vector<int> roots_;
+  /*! \brief roots of tree i are roots_[root_ptr_[i], root_ptr_[i + 1]) */
+  std::vector<unsigned> root_ptr_;
+};
+}  // namespace gbm
+}  // namespace xgboost
+#endif
@@ -7,6 +7,7 @@
  * \author Tianqi Chen: tianqi.tchen@gmail.com
  */
 #include <cstring>
+#include <algorithm>
 #include "../utils/utils.h"
 #include "../utils/io.h"
 
@@ -62,13 +63,15 @@ class TreeModel {
     union Info {
       float leaf_value;
       TSplitCond split_cond;
+      unsigned cat_begin;
     };
    private:
     // pointer to parent, highest bit is used to indicate whether it's a left child or not 
     int parent_;
     // pointer to left, right
     int cleft_, cright_;
-    // split feature index, left split or right split depends on the highest bit
+    // split feature index, left split or right split depends on the highest bit,
+    // the second highest bit marks a categorical split
     unsigned sindex_;            
     // extra info
     Info info_;
@@ -92,7 +95,11 @@ class TreeModel {
     }
     /*! \brief feature index of split condition */
     inline unsigned split_index(void) const {
-      return sindex_ & ((1U<<31) - 1U);
+      return sindex_ & ((1U<<30) - 1U);
+    }
+    /*! \brief whether the node splits by a set of categories, the categories in the set go left */
+    inline bool is_categorical(void) const {
+      return ((sindex_ >> 30) & 1U) != 0;
     }
     /*! \brief when feature is unknown, whether goes to left child */
     inline bool default_left(void) const {
@@ -110,6 +117,10 @@ class TreeModel {
     inline TSplitCond split_cond(void) const {
       return (this->info_).split_cond;
     }
+    /*! \brief start of the category set of a categorical split in the category storage of the tree */
+    inline unsigned cat_begin(void) const {
+      return (this->info_).cat_begin;
+    }
     /*! \brief get parent of the node */
     inline int parent(void) const {
       return parent_ & ((1U << 31) - 1);
@@ -157,6 +168,8 @@ class TreeModel {
   std::vector<Node> nodes;
   // stats of nodes
   std::vector<TNodeStat> stats;
+  // category sets of the categorical splits, each one is its number of words followed by the bit words
+  std::vector<unsigned> cat_bits;
  protected:
   // free node space, used during training process
   std::vector<int> deleted_nodes;
@@ -171,9 +184,165 @@ class TreeModel {
     param.num_deleted = 0;
     nodes.resize(1);
   }
+  /*! \brief get node given nid */
+  inline Node &operator[](int nid) {
+    return nodes[nid];
+  }
+  /*! \brief get node given nid */
+  inline const Node &operator[](int nid) const {
+    return nodes[nid];
+  }
+  /*! \brief get node statistics given nid */
+  inline NodeStat &stat(int nid) {
+    return stats[nid];
+  }
+  /*! \brief get node statistics given nid */
+  inline const NodeStat &stat(int nid) const {
+    return stats[nid];
+  }
+  /*! 
+   * \brief add child nodes to node
+   * \param nid node id to add childs
+   */
+  inline void AddChilds(int nid) {
+    int pleft = this->AllocNode();
+    int pright = this->AllocNode();
+    nodes[nid].cleft_ = pleft;
+    nodes[nid].cright_ = pright;
+    nodes[pleft].set_parent(nid, true);
+    nodes[pright].set_parent(nid, false);
+  }
+  /*!
+   * \brief set a categorical split, the categories in the set go to the left child
+   * \param nid node id
+   * \param split_index feature index to split
+   * \param bits category set, bit c of word c / 32 is set when category c goes left
+   * \param default_left the default direction when feature is unknown
+   */
+  inline void SetCategoricalSplit(int nid, unsigned split_index,
+                                  const std::vector<unsigned> &bits, bool default_left) {
+    nodes[nid].set_split(split_index | (1U << 30), 0.0f, default_left);
+    nodes[nid].info_.cat_begin = static_cast<unsigned>(cat_bits.size());
+    cat_bits.push_back(static_cast<unsigned>(bits.size()));
+    cat_bits.insert(cat_bits.end(), bits.begin(), bits.end());
+  }
+  /*! \brief category set of categorical split node nid, its number of words followed by the bit words */
+  inline const unsigned *CategorySet(int nid) const {
+    return &cat_bits[nodes[nid].cat_begin()];
+  }
+  /*!
+   * \brief whether a value of the split feature goes to the left child of categorical split node nid,
+   *        values that are not category ids of the set go right
+   */
+  inline bool CategoryGoLeft(int nid, float fvalue) const {
+    if (!(fvalue >= 0.0f)) return false;
+    const unsigned *bits = &cat_bits[nodes[nid].cat_begin()];
+    const unsigned cat = static_cast<unsigned>(fvalue);
+    return cat < bits[0] * 32U && ((bits[1 + (cat >> 5)] >> (cat & 31U)) & 1U) != 0;
+  }
+  /*!
+   * \brief get the child of split node pid that an instance goes to
+   * \param pid split node id
+   * \param fvalue value of the split feature
+   * \param is_unknown whether the split feature is missing
+   */
+  inline int GetNext(int pid, float fvalue, bool is_unknown) const {
+    const Node &n = nodes[pid];
+    if (is_unknown) return n.cdefault();
+    if (n.is_categorical()) return this->CategoryGoLeft(pid, fvalue) ? n.cleft() : n.cright();
+    return fvalue < n.split_cond() ? n.cleft() : n.cright();
+  }
+  /*!
+   * \brief turn a node whose children are both leaves into a leaf,
+   *        the slots of the children are recycled by later allocations
+   * \param rid node id of the node
+   * \param value new leaf value
+   */
+  inline void ChangeToLeaf(int rid, float value) {
+    utils::Assert(nodes[nodes[rid].cleft()].is_leaf(), "can not delete a non-leaf child");
+    utils::Assert(nodes[nodes[rid].cright()].is_leaf(), "can not delete a non-leaf child");
+    this->DeleteNode(nodes[rid].cleft());
+    this->DeleteNode(nodes[rid].cright());
+    nodes[rid].set_leaf(value);
+  }
+  /*!
+   * \brief renumber the nodes in breadth first order and drop the deleted slots,
+   *        the roots keep their ids
+   */
+  inline void Compact(void) {
+    if (param.num_deleted == 0) return;
+    std::vector<int> order, remap(param.num_nodes, -1);
+    for (int i = 0; i < param.num_roots; ++i) order.push_back(i);
+    for (size_t k = 0; k < order.size(); ++k) {
+      const Node &n = nodes[order[k]];
+      remap[order[k]] = static_cast<int>(k);
+      if (!n.is_leaf()) {
+        order.push_back(n.cleft()); order.push_back(n.cright());
+      }
+    }
+    std::vector<Node> nnodes(order.size());
+    std::vector<TNodeStat> nstats(order.size());
+    std::vector<unsigned> nbits;
+    for (size_t k = 0; k < order.size(); ++k) {
+      nnodes[k] = nodes[order[k]];
+      nstats[k] = stats[order[k]];
+      Node &n = nnodes[k];
+      if (!n.is_root()) n.set_parent(remap[n.parent()], n.is_left_child());
+      if (!n.is_leaf()) {
+        n.cleft_ = remap[n.cleft_]; n.cright_ = remap[n.cright_];
+        // the category sets of the removed splits are dropped
+        if (n.is_categorical()) {
+          const unsigned begin = n.cat_begin();
+          n.info_.cat_begin = static_cast<unsigned>(nbits.size());
+          nbits.insert(nbits.end(), cat_bits.begin() + begin,
+                       cat_bits.begin() + begin + 1 + cat_bits[begin]);
+        }
+      }
+    }
+    nodes.swap(nnodes); stats.swap(nstats); cat_bits.swap(nbits);
+    param.num_nodes = static_cast<int>(nodes.size());
+    param.num_deleted = 0;
+    deleted_nodes.clear();
+  }
+  /*! 
+   * \brief get current depth
+   * \param nid node id
+   */
+  inline int GetDepth(int nid) const {
+    int depth = 0;
+    while (!nodes[nid].is_root()) {
+      nid = nodes[nid].parent();
+      ++depth;
+    }
+    return depth;
+  }
+  /*! 
+   * \brief get maximum depth
+   * \param nid node id
+   */
+  inline int MaxDepth(int nid) const {
+    if (nodes[nid].is_leaf()) return 0;
+    return std::max(MaxDepth(nodes[nid].cleft())+1,
+                    MaxDepth(nodes[nid].cright())+1);
+  }
+  /*! \brief get maximum depth over all the roots */
+  inline int MaxDepth(void) const {
+    int maxd = 0;
+    for (int i = 0; i < param.num_roots; ++i) {
+      maxd = std::max(maxd, MaxDepth(i));
+    }
+    return maxd;
+  }
+  /*! \brief number of extra nodes besides the root */
+  inline int num_extra_nodes(void) const {
+    return param.num_nodes - param.num_roots - param.num_deleted;
+  }
   /*! \brief initialize the model */
   inline void InitModel(void) {
     param.num_nodes = param.num_roots;
+    param.num_deleted = 0;
+    deleted_nodes.clear();
+    cat_bits.clear();
     nodes.resize(param.num_nodes);
     stats.resize(param.num_nodes);
     for (int i = 0; i < param.num_nodes; ++i) {
@@ -186,11 +355,24 @@ class TreeModel {
    * \param fo output stream
    */
   inline void SaveModel(utils::IStream &fo) const {
+    if (param.num_deleted != 0) {
+      // saved models never carry deleted slots
+      TreeModel<TSplitCond, TNodeStat> dense(*this);
+      dense.Compact();
+      dense.SaveModel(fo);
+      return;
+    }
     utils::Assert( param.num_nodes == (int)nodes.size() );
     utils::Assert( param.num_nodes == (int)stats.size() );
     fo.Write( &param, sizeof(Param) );
     fo.Write( &nodes[0], sizeof(Node) * nodes.size() );
     fo.Write( &stats[0], sizeof(NodeStat) * nodes.size() );
+    // the category sets follow only in trees with categorical splits, older models load unchanged
+    if (this->HasCategoricalSplit()) {
+      const unsigned ncat = static_cast<unsigned>(cat_bits.size());
+      fo.Write( &ncat, sizeof(unsigned) );
+      fo.Write( &cat_bits[0], sizeof(unsigned) * cat_bits.size() );
+    }
   }
   /*! 
    * \brief load model from stream
@@ -201,6 +383,13 @@ class TreeModel {
     nodes.resize( param.num_nodes ); stats.resize( param.num_nodes );
     utils::Assert( fi.Read( &nodes[0], sizeof(Node) * nodes.size() ) > 0, "TreeModel::Node" );
     utils::Assert( fi.Read( &stats[0], sizeof(NodeStat) * stats.size() ) > 0, "TreeModel::Node" );
+    cat_bits.clear();
+    if (this->HasCategoricalSplit()) {
+      unsigned ncat;
+      utils::Assert( fi.Read( &ncat, sizeof(unsigned) ) > 0, "TreeModel::cat_bits" );
+      cat_bits.resize( ncat );
+      utils::Assert( fi.Read( &cat_bits[0], sizeof(unsigned) * ncat ) > 0, "TreeModel::cat_bits" );
+    }
 
     deleted_nodes.resize( 0 );
     for (int i = param.num_roots; i < param.num_nodes; ++i) {
@@ -208,6 +397,35 @@ class TreeModel {
     }
     utils::Assert( (int)deleted_nodes.size() == param.num_deleted, "number of deleted nodes do not match" );
   }
+ private:
+  // whether a live split node of the tree is categorical
+  inline bool HasCategoricalSplit(void) const {
+    for (int i = 0; i < param.num_nodes; ++i) {
+      if (!nodes[i].is_leaf() && !(i >= param.num_roots && nodes[i].is_root()) &&
+          nodes[i].is_categorical()) return true;
+    }
+    return false;
+  }
+  // allocate a new node, a deleted slot is reused first, otherwise the node is appended to the node array
+  inline int AllocNode(void) {
+    if (param.num_deleted != 0) {
+      int nd = deleted_nodes.back();
+      deleted_nodes.pop_back();
+      --param.num_deleted;
+      return nd;
+    }
+    int nd = param.num_nodes++;
+    nodes.resize(param.num_nodes);
+    stats.resize(param.num_nodes);
+    return nd;
+  }
+  // mark a node as deleted, deleted nodes are marked as roots beyond num_roots
+  inline void DeleteNode(int nid) {
+    utils::Assert(nid >= param.num_roots, "can not delete root");
+    deleted_nodes.push_back(nid);
+    nodes[nid].set_parent(-1);
+    ++param.num_deleted;
+  }
 };
 
 
@@ -231,21 +449,64 @@ struct TreeParamTrain {
   int default_direction;
   // whether we want to do subsample
   float subsample;
+  // how the rows of a tree are sampled, 0: uniform with subsample, 1: gradient based one-side sampling
+  int sampling_method;
+  // gradient based sampling: fraction of rows with the largest |gradient| that are always kept
+  float top_rate;
+  // gradient based sampling: fraction of rows drawn at random from the rest
+  float other_rate;
+  // fraction of the features used by a tree
+  float colsample_bytree;
+  // fraction of the features of the tree used by each depth, one sample per depth even under lossguide
+  float colsample_bylevel;
   // whether to use layerwise aware regularization
   int use_layerwise;
   // number of threads to be used for tree construction, if OpenMP is enabled, if equals 0, use system default
   int nthread;
+  // maximum number of bins of each feature in histogram based tree construction
+  int max_bin;
+  // rank error bound of the weighted quantile sketch used to propose the split candidates
+  float sketch_eps;
+  // maximum number of bins of a categorical feature, the rare categories beyond it share one bin
+  int max_cat_bins;
+  // whether mutually exclusive features are bundled in histogram based tree construction
+  int enable_bundle;
+  // whether histogram based tree construction works on 16 bit fixed point gradients
+  int use_quantized_grad;
+  // fraction of the rows in which the features of a bundle may be present together
+  float max_conflict_rate;
+  // how the tree grows, 0: depthwise, level by level, 1: lossguide, split the node with largest loss change first
+  int grow_policy;
+  // maximum number of leaves of each root of a tree in lossguide growth, 0 means no limit
+  int max_leaves;
+  // tree construction method, same code as tree_maker, 0: exact, 2: hist, 3: approx, -1 means decided by tree_maker
+  int tree_method;
   /*! \brief constructor */
   TreeParamTrain(void) {
     learning_rate = 0.3f;
+    min_split_loss = 0.0f;
     min_child_weight = 1.0f;
     max_depth = 6;
     reg_lambda = 1.0f;
     reg_method = 2;
     default_direction = 0;
     subsample = 1.0f;
+    sampling_method = 0;
+    top_rate = 0.2f;
+    other_rate = 0.1f;
+    colsample_bytree = 1.0f;
+    colsample_bylevel = 1.0f;
     use_layerwise = 0;
     nthread = 0;
+    max_bin = 256;
+    sketch_eps = 0.03f;
+    max_cat_bins = 256;
+    enable_bundle = 1;
+    use_quantized_grad = 0;
+    max_conflict_rate = 0.0f;
+    grow_policy = 0;
+    max_leaves = 0;
+    tree_method = -1;
   }
   /*! 
   * \brief set parameters from outside 
@@ -265,13 +526,152 @@ struct TreeParamTrain {
     if( !strcmp( name, "reg_lambda") )        reg_lambda = (float)atof( val );
     if( !strcmp( name, "reg_method") )        reg_method = (float)atof( val );
     if( !strcmp( name, "subsample") )         subsample  = (float)atof( val );
+    if( !strcmp( name, "top_rate") )          top_rate = (float)atof( val );
+    if( !strcmp( name, "other_rate") )        other_rate = (float)atof( val );
+    if( !strcmp( name, "colsample_bytree") )  colsample_bytree = (float)atof( val );
+    if( !strcmp( name, "colsample_bylevel") ) colsample_bylevel = (float)atof( val );
     if( !strcmp( name, "use_layerwise") )     use_layerwise = atoi( val );
     if( !strcmp( name, "nthread") )           nthread = atoi( val );
+    if( !strcmp( name, "max_bin") )           max_bin = atoi( val );
+    if( !strcmp( name, "sketch_eps") )        sketch_eps = (float)atof( val );
+    if( !strcmp( name, "max_cat_bins") )      max_cat_bins = atoi( val );
+    if( !strcmp( name, "enable_bundle") )     enable_bundle = atoi( val );
+    if( !strcmp( name, "use_quantized_grad") ) use_quantized_grad = atoi( val );
+    if( !strcmp( name, "max_conflict_rate") ) max_conflict_rate = (float)atof( val );
+    if( !strcmp( name, "max_leaves") )        max_leaves = atoi( val );
     if( !strcmp( name, "default_direction") ) {
       if( !strcmp( val, "learn") )  default_direction = 0;
       if( !strcmp( val, "left") )   default_direction = 1;
       if( !strcmp( val, "right") )  default_direction = 2;
     }
+    if( !strcmp( name, "tree_method") ) {
+      if( !strcmp( val, "exact") ) tree_method = 0;
+      else if( !strcmp( val, "hist") ) tree_method = 2;
+      else if( !strcmp( val, "approx") ) tree_method = 3;
+      else utils::Error("unknown tree_method %s", val);
+    }
+    if( !strcmp( name, "grow_policy") ) {
+      if( !strcmp( val, "depthwise") ) grow_policy = 0;
+      else if( !strcmp( val, "lossguide") ) grow_policy = 1;
+      else utils::Error("unknown grow_policy %s", val);
+    }
+    if( !strcmp( name, "sampling_method") ) {
+      if( !strcmp( val, "uniform") ) sampling_method = 0;
+      else if( !strcmp( val, "goss") ) sampling_method = 1;
+      else utils::Error("unknown sampling_method %s", val);
+    }
+  }
+  /*! \brief calculate the cost of loss function given statistics */
+  inline double CalcGain(double sum_grad, double sum_hess) const {
+    if (sum_hess < min_child_weight) return 0.0;
+    return (sum_grad * sum_grad) / (sum_hess + reg_lambda);
+  }
+  /*! \brief calculate the weight of a leaf given statistics */
+  inline double CalcWeight(double sum_grad, double sum_hess) const {
+    if (sum_hess < min_child_weight) return 0.0;
+    return - sum_grad / (sum_hess + reg_lambda);
+  }
+  /*! \brief given the loss change, whether we need to invoke pruning */
+  inline bool need_prune(double loss_chg, int depth) const {
+    return loss_chg < this->min_split_loss;
+  }
+  /*! \brief whether we can split with current hessian */
+  inline bool cannot_split(double sum_hess, int depth) const {
+    return sum_hess < this->min_child_weight * 2.0;
+  }
+};
+
+/*! \brief sum of gradient statistics, used to evaluate a split */
+struct GradStats {
+  /*! \brief sum of first order gradient */
+  double sum_grad;
+  /*! \brief sum of second order gradient */
+  double sum_hess;
+  /*! \brief constructor */
+  GradStats(void) {
+    this->Clear();
+  }
+  /*! \brief clear the statistics */
+  inline void Clear(void) {
+    sum_grad = sum_hess = 0.0;
+  }
+  /*! \brief whether the statistics is empty */
+  inline bool Empty(void) const {
+    return sum_hess == 0.0;
+  }
+  /*! \brief add statistics of one instance */
+  inline void Add(double grad, double hess) {
+    sum_grad += grad; sum_hess += hess;
+  }
+  /*! \brief add another statistics */
+  inline void Add(const GradStats &b) {
+    this->Add(b.sum_grad, b.sum_hess);
+  }
+  /*! \brief set current value to a - b */
+  inline void SetSubstract(const GradStats &a, const GradStats &b) {
+    sum_grad = a.sum_grad - b.sum_grad;
+    sum_hess = a.sum_hess - b.sum_hess;
+  }
+  /*! \brief calculate the gain of current statistics */
+  inline double CalcGain(const TreeParamTrain &param) const {
+    return param.CalcGain(sum_grad, sum_hess);
+  }
+  /*! \brief calculate the leaf weight of current statistics */
+  inline double CalcWeight(const TreeParamTrain &param) const {
+    return param.CalcWeight(sum_grad, sum_hess);
+  }
+};
+
+/*! \brief best split candidate found so far */
+struct SplitEntry {
+  /*! \brief loss change after the split */
+  float loss_chg;
+  /*! \brief split index, the highest bit indicates the default direction */
+  unsigned sindex;
+  /*! \brief split value */
+  float split_value;
+  /*! \brief constructor */
+  SplitEntry(void) : loss_chg(0.0f), sindex(0), split_value(0.0f) {}
+  /*! 
+   * \brief whether a candidate should replace current entry,
+   *        ties are broken by feature index so that the result does not depend on thread scheduling
+   */
+  inline bool NeedReplace(float new_loss_chg, unsigned split_index) const {
+    if (this->split_index() <= split_index) {
+      return new_loss_chg > this->loss_chg;
+    } else {
+      return !(this->loss_chg > new_loss_chg);
+    }
+  }
+  /*! 
+   * \brief update the split entry, replace it if the candidate is better
+   * \return whether the entry is replaced
+   */
+  inline bool Update(float new_loss_chg, unsigned split_index,
+                     float new_split_value, bool default_left) {
+    if (this->NeedReplace(new_loss_chg, split_index)) {
+      this->loss_chg = new_loss_chg;
+      if (default_left) split_index |= (1U << 31);
+      this->sindex = split_index;
+      this->split_value = new_split_value;
+      return true;
+    }
+    return false;
+  }
+  /*! \brief update using another split entry */
+  inline bool Update(const SplitEntry &e) {
+    if (this->NeedReplace(e.loss_chg, e.split_index())) {
+      *this = e; return true;
+    }
+    return false;
+  }
+  /*! \brief feature index to split on */
+  inline unsigned split_index(void) const {
+    return sindex & ((1U << 31) - 1U);
+  }
+  /*! \brief whether missing value goes to left branch */
+  inline bool default_left(void) const {
+    return (sindex >> 31) != 0;
   }
 };
 
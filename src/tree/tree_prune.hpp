@@ -0,0 +1,49 @@
+#ifndef XGBOOST_TREE_TREE_PRUNE_HPP
+#define XGBOOST_TREE_TREE_PRUNE_HPP
+/*!
+ * \file tree_prune.hpp
+ * \brief bottom-up pruning of a grown tree, a split whose children are both leaves
+ *        is collapsed when its loss change is below min_split_loss; the tree makers only
+ *        reject splits without gain, so a weak split above strong ones is kept
+ */
+#include "tree_model.h"
+
+namespace xgboost {
+namespace gbm {
+/*! \brief prune the splits of a tree bottom-up */
+class TreePruner {
+ public:
+  TreePruner(const TreeParamTrain &pparam, RegTree &ptree)
+      : param(pparam), tree(ptree) {
+  }
+  /*!
+   * \brief prune the tree, the slots of the removed nodes are recycled by the tree
+   * \return number of nodes pruned
+   */
+  inline int DoPrune(void) {
+    int num_pruned = 0;
+    for (int i = 0; i < tree.param.num_roots; ++i) {
+      this->TryPrune(i, 0, num_pruned);
+    }
+    return num_pruned;
+  }
+
+ private:
+  // prune the subtree of nid, return whether nid is a leaf afterwards
+  inline bool TryPrune(int nid, int depth, int &num_pruned) {
+    if (tree[nid].is_leaf()) return true;
+    const bool left = this->TryPrune(tree[nid].cleft(), depth + 1, num_pruned);
+    const bool right = this->TryPrune(tree[nid].cright(), depth + 1, num_pruned);
+    if (!left || !right || !param.need_prune(tree.stat(nid).loss_chg, depth)) return false;
+    tree.ChangeToLeaf(nid, tree.stat(nid).base_weight * param.learning_rate);
+    num_pruned += 2;
+    return true;
+  }
+  // training parameter
+  const TreeParamTrain &param;
+  // the tree to be pruned
+  RegTree &tree;
+};
+}  // namespace gbm
+}  // namespace xgboost
+#endif
@@ -0,0 +1,85 @@
+#ifndef XGBOOST_UTILS_ALIGNED_H
+#define XGBOOST_UTILS_ALIGNED_H
+/*!
+ * \file aligned.h
+ * \brief cache line aligned allocation, used by the scratch buffers that each thread
+ *        writes to, so that two threads never share a cache line
+ */
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include "utils.h"
+
+namespace xgboost {
+namespace utils {
+/*! \brief size of a cache line in bytes */
+const size_t kCacheLine = 64;
+/*!
+ * \brief allocate size bytes starting at a cache line boundary
+ *        the offset to the start of the malloc block is kept in the byte before the returned pointer
+ */
+inline void *AlignedMalloc(size_t size) {
+  char *raw = static_cast<char*>(malloc(size + kCacheLine));
+  if (raw == NULL) throw std::bad_alloc();
+  const size_t offset = kCacheLine - reinterpret_cast<size_t>(raw) % kCacheLine;
+  char *ptr = raw + offset;
+  ptr[-1] = static_cast<char>(offset);
+  return ptr;
+}
+/*! \brief free a block allocated by AlignedMalloc */
+inline void AlignedFree(void *ptr) {
+  if (ptr == NULL) return;
+  char *p = static_cast<char*>(ptr);
+  free(p - static_cast<unsigned char>(p[-1]));
+}
+/*! \brief round size up to a multiple of the cache line */
+inline size_t AlignedSize(size_t size) {
+  return (size + kCacheLine - 1) / kCacheLine * kCacheLine;
+}
+/*! \brief allocator of std containers whose storage starts at a cache line boundary */
+template<typename T>
+class AlignedAllocator {
+ public:
+  typedef T value_type;
+  typedef T *pointer;
+  typedef const T *const_pointer;
+  typedef T &reference;
+  typedef const T &const_reference;
+  typedef size_t size_type;
+  typedef ptrdiff_t difference_type;
+  template<typename U>
+  struct rebind {
+    typedef AlignedAllocator<U> other;
+  };
+  AlignedAllocator(void) {}
+  template<typename U>
+  AlignedAllocator(const AlignedAllocator<U> &other) {}
+  inline pointer address(reference x) const { return &x; }
+  inline const_pointer address(const_reference x) const { return &x; }
+  inline pointer allocate(size_type n, const void *hint = 0) {
+    return static_cast<pointer>(AlignedMalloc(n * sizeof(T)));
+  }
+  inline void deallocate(pointer p, size_type n) {
+    AlignedFree(p);
+  }
+  inline size_type max_size(void) const {
+    return static_cast<size_type>(-1) / sizeof(T);
+  }
+  inline void construct(pointer p, const T &val) {
+    new (p) T(val);
+  }
+  inline void destroy(pointer p) {
+    p->~T();
+  }
+};
+template<typename T, typename U>
+inline bool operator==(const AlignedAllocator<T> &a, const AlignedAllocator<U> &b) {
+  return true;
+}
+template<typename T, typename U>
+inline bool operator!=(const AlignedAllocator<T> &a, const AlignedAllocator<U> &b) {
+  return false;
+}
+}  // namespace utils
+}  // namespace xgboost
+#endif
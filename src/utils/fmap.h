@@ -10,6 +10,7 @@
 #include <vector>
 #include <string>
 #include <cstring>
+#include <algorithm>
 #include "./utils.h"
 
 namespace xgboost {
@@ -21,7 +22,8 @@ class FeatMap {
     kIndicator = 0,
     kQuantitive = 1,
     kInteger = 2,
-    kFloat = 3
+    kFloat = 3,
+    kCategorical = 4
   };
   // function definitions
   /*! \brief load feature map from text format */
@@ -69,7 +71,8 @@ class FeatMap {
     if (!strcmp("q", tname)) return kQuantitive;
     if (!strcmp("int", tname)) return kInteger;
     if (!strcmp("float", tname)) return kFloat;
-    utils::Error("unknown feature type, use i for indicator and q for quantity");
+    if (!strcmp("c", tname)) return kCategorical;
+    utils::Error("unknown feature type, use i for indicator, q for quantity and c for categorical");
     return kIndicator;
   }
   /*! \brief name of the feature */
@@ -78,6 +81,18 @@ class FeatMap {
   std::vector<Type> types_;
 };
 
+/*!
+ * \brief parse a feature range given as "a-b" or a single index "a"
+ * \param val the text to parse
+ * \param a begin of the range
+ * \param b end of the range, exclusive
+ */
+inline void ParseFeatRange(const char *val, int &a, int &b) {
+  if (sscanf(val, "%d-%d", &a, &b) == 2) return;
+  utils::Assert(sscanf(val, "%d", &a) == 1);
+  b = a + 1;
+}
+
 /*! \brief feature constraint, allow or disallow some feature during training */
 class FeatConstrain {
  public:
@@ -88,11 +103,11 @@ class FeatConstrain {
   inline void SetParam(const char *name, const char *val) {
     int a, b;
     if (!strcmp(name, "fban")) {
-      this->ParseRange(val, a, b);
+      ParseFeatRange(val, a, b);
       this->SetRange(a, b, -1);
     }
     if (!strcmp(name, "fpass")) {
-      this->ParseRange(val, a, b);
+      ParseFeatRange(val, a, b);
       this->SetRange(a, b, +1);
     }
     if (!strcmp(name, "fdefault")) {
@@ -116,16 +131,45 @@ class FeatConstrain {
       state_[i] = st;
     }  
   }
-  inline void ParseRange(const char *val, int &a, int &b) {
-    if (sscanf(val, "%d-%d", &a, &b) == 2) return;
-    utils::Assert(sscanf(val, "%d", &a) == 1);
-    b = a + 1;
-  }
   /*! \brief default state */
   int default_state_;
   /*! \brief whether the state here is, +1:pass, -1: ban, 0:default */
   std::vector<int> state_;            
 };
+
+/*!
+ * \brief categorical features, their values are category ids,
+ *        and they are split by a subset of categories instead of a threshold
+ */
+class FeatCategorical {
+ public:
+  /*!\brief set parameters, fcat marks a range of features as categorical */
+  inline void SetParam(const char *name, const char *val) {
+    int a, b;
+    if (!strcmp(name, "fcat")) {
+      ParseFeatRange(val, a, b);
+      if (b > (int)flag_.size()) flag_.resize(b, false);
+      for (int i = a; i < b; ++i) {
+        flag_[i] = true;
+      }
+    }
+  }
+  /*! \brief whether any feature is categorical */
+  inline bool HasCategorical(void) const {
+    return std::find(flag_.begin(), flag_.end(), true) != flag_.end();
+  }
+  /*! \brief whether a feature index is categorical */
+  inline bool IsCategorical(unsigned index) const {
+    return index < flag_.size() && flag_[index];
+  }
+  /*! \return flag of each feature, features beyond the end are not categorical */
+  inline const std::vector<bool> &Flags(void) const {
+    return flag_;
+  }
+ private:
+  /*! \brief whether each feature is categorical */
+  std::vector<bool> flag_;
+};
 }  // namespace utils
 }  // namespace xgboost
 #endif  // XGBOOST_UTILS_FMAP_H_
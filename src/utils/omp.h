@@ -13,6 +13,7 @@
 #warning "OpenMP is not available, compile to single thread code"
 inline int omp_get_thread_num() { return 0; }
 inline int omp_get_num_threads() { return 1; }
+inline int omp_get_max_threads() { return 1; }
 inline void omp_set_num_threads(int nthread) {}
 #endif
 #endif
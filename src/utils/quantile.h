@@ -0,0 +1,239 @@
+#ifndef XGBOOST_UTILS_QUANTILE_H
+#define XGBOOST_UTILS_QUANTILE_H
+/*!
+ * \file quantile.h
+ * \brief weighted quantile sketch, used to propose the split candidates of a feature
+ *        in one streaming pass, without sorting the values
+ */
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include "./utils.h"
+
+namespace xgboost {
+namespace utils {
+/*!
+ * \brief summary of a weighted quantile sketch, entries are sorted by value
+ * \tparam DType type of the value
+ * \tparam RType type of the rank (weight)
+ */
+template<typename DType, typename RType>
+struct WQSummary {
+  /*! \brief an entry in the summary */
+  struct Entry {
+    /*! \brief minimum rank of the value */
+    RType rmin;
+    /*! \brief maximum rank of the value */
+    RType rmax;
+    /*! \brief weight of the value itself */
+    RType wmin;
+    /*! \brief the value */
+    DType value;
+    Entry(void) {}
+    Entry(RType rmin, RType rmax, RType wmin, DType value)
+        : rmin(rmin), rmax(rmax), wmin(wmin), value(value) {}
+    /*! \brief minimum rank of the next value */
+    inline RType rmin_next(void) const {
+      return rmin + wmin;
+    }
+    /*! \brief maximum rank of the previous value */
+    inline RType rmax_prev(void) const {
+      return rmax - wmin;
+    }
+  };
+  /*! \brief entries of the summary */
+  std::vector<Entry> data;
+  /*! \brief total weight of the summarized values */
+  inline RType TotalWeight(void) const {
+    return data.size() == 0 ? RType(0) : data.back().rmax;
+  }
+  /*! \brief maximum rank error of the summary */
+  inline RType MaxError(void) const {
+    if (data.size() == 0) return RType(0);
+    RType res = data[0].rmax - data[0].rmin - data[0].wmin;
+    for (size_t i = 1; i < data.size(); ++i) {
+      res = std::max(data[i].rmax_prev() - data[i - 1].rmin_next(), res);
+      res = std::max(data[i].rmax - data[i].rmin - data[i].wmin, res);
+    }
+    return res;
+  }
+  /*!
+   * \brief make the exact summary of a batch of values, the batch is sorted inplace
+   * \param batch (value, weight) pairs
+   */
+  inline void SetFromBatch(std::vector< std::pair<DType, RType> > &batch) {
+    std::sort(batch.begin(), batch.end());
+    data.clear();
+    RType wsum = 0;
+    for (size_t i = 0; i < batch.size();) {
+      const DType v = batch[i].first;
+      RType w = 0;
+      for (; i < batch.size() && batch[i].first == v; ++i) w += batch[i].second;
+      data.push_back(Entry(wsum, wsum + w, w, v));
+      wsum += w;
+    }
+  }
+  /*!
+   * \brief keep at most maxsize entries of src, the chosen entries are
+   *        evenly spaced in rank, the first and the last entries are always kept
+   * \param src source summary
+   * \param maxsize maximum number of entries, must be at least 2
+   */
+  inline void SetPrune(const WQSummary &src, size_t maxsize) {
+    if (src.data.size() <= maxsize) {
+      data = src.data; return;
+    }
+    data.clear();
+    const RType begin = src.data[0].rmax;
+    const RType range = src.data.back().rmin - src.data[0].rmax;
+    const size_t n = maxsize - 1;
+    data.push_back(src.data[0]);
+    size_t lastidx = 0;
+    for (size_t k = 1, i = 0; k < n; ++k) {
+      const RType dx2 = 2 * ((k * range) / n + begin);
+      // find the last i such that rmin[i] + rmax[i] <= dx2
+      while (i < src.data.size() - 1 && dx2 >= src.data[i + 1].rmax + src.data[i + 1].rmin) ++i;
+      if (i == src.data.size() - 1) break;
+      if (dx2 < src.data[i].rmin_next() + src.data[i + 1].rmax_prev()) {
+        if (i != lastidx) {
+          data.push_back(src.data[i]); lastidx = i;
+        }
+      } else {
+        if (i + 1 != lastidx) {
+          data.push_back(src.data[i + 1]); lastidx = i + 1;
+        }
+      }
+    }
+    if (lastidx != src.data.size() - 1) data.push_back(src.data.back());
+  }
+  /*!
+   * \brief merge two summaries, the result summarizes the union of the values
+   * \param sa first summary
+   * \param sb second summary
+   */
+  inline void SetCombine(const WQSummary &sa, const WQSummary &sb) {
+    if (sa.data.size() == 0) {
+      data = sb.data; return;
+    }
+    if (sb.data.size() == 0) {
+      data = sa.data; return;
+    }
+    data.clear();
+    size_t a = 0, b = 0;
+    RType aprev_rmin = 0, bprev_rmin = 0;
+    while (a < sa.data.size() && b < sb.data.size()) {
+      const Entry &ea = sa.data[a], &eb = sb.data[b];
+      if (ea.value == eb.value) {
+        data.push_back(Entry(ea.rmin + eb.rmin, ea.rmax + eb.rmax,
+                             ea.wmin + eb.wmin, ea.value));
+        aprev_rmin = ea.rmin_next(); bprev_rmin = eb.rmin_next();
+        ++a; ++b;
+      } else if (ea.value < eb.value) {
+        data.push_back(Entry(ea.rmin + bprev_rmin, ea.rmax + eb.rmax_prev(),
+                             ea.wmin, ea.value));
+        aprev_rmin = ea.rmin_next();
+        ++a;
+      } else {
+        data.push_back(Entry(eb.rmin + aprev_rmin, eb.rmax + ea.rmax_prev(),
+                             eb.wmin, eb.value));
+        bprev_rmin = eb.rmin_next();
+        ++b;
+      }
+    }
+    for (; a < sa.data.size(); ++a) {
+      const Entry &ea = sa.data[a];
+      data.push_back(Entry(ea.rmin + bprev_rmin, ea.rmax + sb.data.back().rmax,
+                           ea.wmin, ea.value));
+    }
+    for (; b < sb.data.size(); ++b) {
+      const Entry &eb = sb.data[b];
+      data.push_back(Entry(eb.rmin + aprev_rmin, eb.rmax + sa.data.back().rmax,
+                           eb.wmin, eb.value));
+    }
+  }
+};
+
+/*!
+ * \brief weighted quantile sketch, values are pushed in any order,
+ *        the rank error of the summary is bounded by eps * total weight
+ * \tparam DType type of the value
+ * \tparam RType type of the rank (weight)
+ */
+template<typename DType, typename RType>
+class WQuantileSketch {
+ public:
+  typedef WQSummary<DType, RType> Summary;
+  /*!
+   * \brief initialize the sketch
+   * \param maxn maximum number of values that will be pushed
+   * \param eps rank error bound
+   */
+  inline void Init(size_t maxn, double eps) {
+    utils::Assert(eps > 0.0 && eps < 1.0, "sketch_eps must be in (0, 1)");
+    nlevel_ = 1;
+    while (true) {
+      limit_size_ = static_cast<size_t>(std::ceil(nlevel_ / eps)) + 1;
+      if ((static_cast<size_t>(1) << nlevel_) * limit_size_ >= maxn) break;
+      ++nlevel_;
+    }
+    // the queue grows on demand, many sketches may be alive at the same time
+    inqueue_.clear();
+    level_.clear();
+  }
+  /*!
+   * \brief bound of the memory taken by the sketch once the maxn values given to Init are pushed:
+   *        a full queue and one pruned summary per level
+   */
+  inline size_t MaxBytes(void) const {
+    return limit_size_ * (2 * sizeof(std::pair<DType, RType>) +
+                          (nlevel_ + 1) * sizeof(typename Summary::Entry));
+  }
+  /*! \brief push a value into the sketch */
+  inline void Push(DType value, RType weight = 1) {
+    if (weight <= 0) return;
+    inqueue_.push_back(std::make_pair(value, weight));
+    if (inqueue_.size() == limit_size_ * 2) this->Flush();
+  }
+  /*!
+   * \brief get the summary of all the values pushed so far
+   * \param out the summary
+   */
+  inline void GetSummary(Summary &out) {
+    out.data.clear();
+    if (inqueue_.size() != 0) this->Flush();
+    Summary temp;
+    for (size_t l = 0; l < level_.size(); ++l) {
+      if (level_[l].data.size() == 0) continue;
+      temp.SetCombine(out, level_[l]);
+      out.data.swap(temp.data);
+    }
+  }
+
+ private:
+  // summarize the queue and push the summary up the levels, merging full levels
+  inline void Flush(void) {
+    Summary temp, merged;
+    temp.SetFromBatch(inqueue_);
+    inqueue_.clear();
+    for (size_t l = 0;; ++l) {
+      if (level_.size() <= l) level_.resize(l + 1);
+      if (level_[l].data.size() == 0) {
+        level_[l].SetPrune(temp, limit_size_); return;
+      }
+      merged.SetCombine(level_[l], temp);
+      temp.SetPrune(merged, limit_size_);
+      level_[l].data.clear();
+    }
+  }
+  /*! \brief number of levels needed for the rank error bound */
+  int nlevel_;
+  /*! \brief maximum number of entries in the summary of a level */
+  size_t limit_size_;
+  /*! \brief values not yet summarized */
+  std::vector< std::pair<DType, RType> > inqueue_;
+  /*! \brief summary of each level, level l summarizes about 2^l batches */
+  std::vector<Summary> level_;
+};
+}  // namespace utils
+}  // namespace xgboost
+#endif
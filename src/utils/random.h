@@ -15,6 +15,7 @@
 typedef unsigned char uint8_t;
 typedef unsigned short int uint16_t;
 typedef unsigned int  uint32_t;
+typedef unsigned __int64 uint64_t;
 #else
 #include <inttypes.h>
 #endif
@@ -26,6 +27,43 @@ namespace random{
 inline void Seed(uint32_t seed) {
   srand(seed);
 }
+/*! \brief draw a seed from the global PRNG, used to seed the fast generators */
+inline uint32_t NextSeed(void) {
+  return static_cast<uint32_t>(rand());
+}
+/*!
+ * \brief small and fast PRNG (xorshift64*) with its own state,
+ *        each thread or each block of work owns one, so nothing is shared
+ */
+class XorShift {
+ public:
+  explicit XorShift(uint64_t seed = 0) {
+    this->Seed(seed);
+  }
+  /*! \brief reset the state, close seeds give unrelated sequences */
+  inline void Seed(uint64_t seed) {
+    // splitmix64 finalizer
+    uint64_t z = seed + 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    state_ = z ^ (z >> 31);
+    if (state_ == 0) state_ = 0x9E3779B97F4A7C15ULL;
+  }
+  /*! \brief next 64 bit random number */
+  inline uint64_t NextUInt64(void) {
+    state_ ^= state_ >> 12;
+    state_ ^= state_ << 25;
+    state_ ^= state_ >> 27;
+    return state_ * 0x2545F4914F6CDD1DULL;
+  }
+  /*! \brief next random number uniform in [0, 1) */
+  inline double NextDouble(void) {
+    return static_cast<double>(this->NextUInt64() >> 11) * (1.0 / 9007199254740992.0);
+  }
+
+ private:
+  uint64_t state_;
+};
 
 }  // namespace random
 }  // namespace xgboost
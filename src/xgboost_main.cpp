@@ -58,6 +58,9 @@ typedef learner::DMatrix DMatrix;
     if( !strcmp("name_dumppath", name)) name_dumppath = val;
     if (!strcmp("name_pred", name)) name_pred = val;
     if (!strcmp("dump_stats", name)) dump_model_stats = atoi(val);
+    if (!strcmp("booster_type", name)) booster_type = atoi(val);
+    if (!strcmp("bst:tree_maker", name)) tree_maker = atoi(val);
+    if (!strcmp("bst:tree_method", name)) tree_method = val;
     if (!strncmp("eval[", name, 5)) {
       char evname[256];
       utils::Assert(sscanf(name, "eval[%[^]]", evname) == 1, 
@@ -76,6 +79,8 @@ typedef learner::DMatrix DMatrix;
     num_round = 10;
     save_period = 0;
     dump_model_stats = 0;
+    booster_type = 0;
+    tree_maker = 0;
     task = "train";                
     model_in = "NULL";
     model_out = "NULL";
@@ -91,18 +96,36 @@ typedef learner::DMatrix DMatrix;
     }
   }
  private:
+  /*!
+   * \brief whether training needs the sorted columns of the data,
+   *        the histogram and approx tree makers only read rows
+   */
+  inline bool NeedColAccess(void) const {
+    if (booster_type != 0) return true;
+    if (tree_method.length() != 0) return tree_method != "hist" && tree_method != "approx";
+    return tree_maker != 2 && tree_maker != 3;
+  }
   inline void InitData (void) {
     if (name_fmap != "NULL") fmap.LoadText(name_fmap.c_str());
+    // the tree booster learns the categorical features of the feature map by their ids
+    for (size_t i = 0; i < fmap.size(); ++i) {
+      if (fmap.type(i) == utils::FeatMap::kCategorical) {
+        char fid[32];
+        sprintf(fid, "%lu", static_cast<unsigned long>(i));
+        this->SetParam("bst:fcat", fid);
+      }
+    }
     if (task == "dump") return;
+    // prediction and evaluation only read rows
     if (task == "pred" || task == "dumppath") {
-      data.CacheLoad(test_path.c_str(), silent!=0, use_buffer!=0);
+      data.CacheLoad(test_path.c_str(), silent!=0, use_buffer!=0, false);
     } else {
       // training 
-      data.CacheLoad(train_path.c_str(), silent!=0, use_buffer!=0);
+      data.CacheLoad(train_path.c_str(), silent!=0, use_buffer!=0, this->NeedColAccess());
       utils::Assert(eval_data_names.size() == eval_data_paths.size());
       for (size_t i = 0; i < eval_data_names.size(); ++i) {
         deval.push_back(new DMatrix());
-        deval.back()->CacheLoad(eval_data_paths[i].c_str(), silent!=0, use_buffer!=0);
+        deval.back()->CacheLoad(eval_data_paths[i].c_str(), silent!=0, use_buffer!=0, false);
       }
     }
     learner.SetData(&data, deval, eval_data_names);
@@ -187,6 +210,11 @@ typedef learner::DMatrix DMatrix;
   std::string name_pred;
   /* \brief whether dump statistics along with model */
   int dump_model_stats;
+  /* \brief type of the booster, 0: tree, 1: linear */
+  int booster_type;
+  /* \brief tree maker and tree method of the tree booster, decide whether columns are needed */
+  int tree_maker;
+  std::string tree_method;
   /* \brief name of feature map */
   std::string name_fmap;
   /* \brief name of dump file */
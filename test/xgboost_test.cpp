@@ -0,0 +1,808 @@
+/*!
+ * \file xgboost_test.cpp
+ * \brief tests of the tree models on synthetic data, the trees are checked against
+ *        brute force computations and against the walk of the trees with RegTree::GetNext
+ *        run by make test, exits with 1 when a check fails
+ */
+#include <cstdio>
+#include <cstdarg>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <set>
+#include <sstream>
+#include <algorithm>
+#include "../src/io/simple_fmatrix-inl.h"
+#include "../src/gbm/gbtree-inl.h"
+#include "../src/utils/random.h"
+
+using namespace xgboost;
+using namespace xgboost::gbm;
+
+namespace {
+/*! \brief number of failed checks */
+int num_failed = 0;
+/*! \brief report a failed check when exp is false */
+inline void Expect(bool exp, const char *fmt, ...) {
+  if (exp) return;
+  va_list args;
+  va_start(args, fmt);
+  fprintf(stderr, "FAILED: ");
+  vfprintf(stderr, fmt, args);
+  fprintf(stderr, "\n");
+  va_end(args);
+  ++num_failed;
+}
+/*! \brief expect a == b element by element, only the first difference is reported */
+inline void ExpectEqual(const std::string &what, const std::vector<float> &a, const std::vector<float> &b) {
+  Expect(a.size() == b.size(), "%s: size %lu vs %lu", what.c_str(),
+         static_cast<unsigned long>(a.size()), static_cast<unsigned long>(b.size()));
+  for (size_t i = 0; i < a.size() && i < b.size(); ++i) {
+    if (a[i] != b[i]) {
+      Expect(false, "%s: row %lu, %g vs %g", what.c_str(), static_cast<unsigned long>(i), a[i], b[i]);
+      return;
+    }
+  }
+}
+/*! \brief whether a and b agree up to a relative error of eps */
+inline bool Near(double a, double b, double eps) {
+  return std::fabs(a - b) <= eps * std::max(1.0, std::max(std::fabs(a), std::fabs(b)));
+}
+/*! \brief in memory stream, to save and load models without files */
+class MemoryStream : public utils::IStream {
+ public:
+  MemoryStream(void) : pos_(0) {}
+  virtual size_t Read(void *ptr, size_t size) {
+    size = std::min(size, buf_.length() - pos_);
+    if (size != 0) memcpy(ptr, buf_.data() + pos_, size);
+    pos_ += size;
+    return size;
+  }
+  virtual void Write(const void *ptr, size_t size) {
+    buf_.append(static_cast<const char*>(ptr), size);
+  }
+
+ private:
+  std::string buf_;
+  size_t pos_;
+};
+/*! \brief GBTree whose boosters are open to the tests */
+class TestGBTree : public GBTree {
+ public:
+  inline size_t NumBooster(void) const {
+    return boosters.size();
+  }
+  inline const RegTree &Tree(size_t i) const {
+    return *boosters[i]->GetTree();
+  }
+  /*! \return number of trees held by the quick scorer of the model */
+  inline size_t NumQuickScorerTree(void) const {
+    return qscorer.NumTree();
+  }
+};
+/*!
+ * \brief synthetic regression data, held both as a sparse matrix and as dense rows,
+ *        the first ncat features are skewed category ids, the others are numbers,
+ *        half of them on a grid so that many rows share a value
+ */
+struct TestData {
+  FMatrixS fmat;
+  std::vector<float> labels;
+  /*! \brief root of each row, empty with a single root */
+  std::vector<unsigned> roots;
+  /*! \brief dense rows, missing is 1 for the features absent from the row */
+  std::vector<float> fvalue;
+  std::vector<int> missing;
+  unsigned nfeat;
+  inline void Init(size_t nrow, unsigned nfeat, unsigned ncat, unsigned kcat,
+                   unsigned nroot, uint64_t seed) {
+    random::XorShift rnd(seed);
+    this->nfeat = nfeat;
+    labels.clear(); roots.clear();
+    fvalue.assign(nrow * nfeat, 0.0f); missing.assign(nrow * nfeat, 1);
+    for (size_t i = 0; i < nrow; ++i) {
+      float label = 0.0f;
+      for (unsigned f = 0; f < nfeat; ++f) {
+        if (rnd.NextDouble() < 0.2) {
+          label += f == 1 ? 0.5f : 0.0f;
+          continue;
+        }
+        const double u = rnd.NextDouble();
+        float v;
+        if (f < ncat) {
+          v = static_cast<float>(static_cast<unsigned>(kcat * u * u));
+          label += static_cast<unsigned>(v) % 3 == 0 ? 1.0f : -0.5f;
+        } else {
+          v = (f - ncat) % 2 == 0 ? static_cast<float>(static_cast<int>(u * 16) / 16.0) : static_cast<float>(u);
+          label += (f + 1) * (v > 0.5f ? v : -v) / nfeat;
+        }
+        fvalue[i * nfeat + f] = v; missing[i * nfeat + f] = 0;
+      }
+      if (nroot > 1) {
+        roots.push_back(static_cast<unsigned>(i % nroot));
+        label += static_cast<float>(i % nroot);
+      }
+      labels.push_back(label);
+    }
+    this->InitMatrix();
+  }
+  /*!
+   * \brief move half of the present values onto the split thresholds of the trees or just below them,
+   *        where the traversals must agree on which values go left
+   */
+  inline void MoveToThresholds(const std::vector<const RegTree*> &trees, uint64_t seed) {
+    std::vector< std::vector<float> > thr(nfeat);
+    for (size_t t = 0; t < trees.size(); ++t) {
+      const RegTree &tree = *trees[t];
+      for (int i = 0; i < tree.param.num_nodes; ++i) {
+        if (tree[i].is_leaf() || tree[i].is_categorical() || tree[i].split_index() >= nfeat) continue;
+        thr[tree[i].split_index()].push_back(tree[i].split_cond());
+      }
+    }
+    random::XorShift rnd(seed);
+    for (size_t k = 0; k < fvalue.size(); ++k) {
+      const std::vector<float> &c = thr[k % nfeat];
+      if (missing[k] != 0 || c.size() == 0 || rnd.NextDouble() < 0.5) continue;
+      const float v = c[rnd.NextUInt64() % c.size()];
+      fvalue[k] = rnd.NextDouble() < 0.5 ? v : nextafterf(v, -1e30f);
+    }
+    this->InitMatrix();
+  }
+  /*! \brief build fmat from the dense rows */
+  inline void InitMatrix(void) {
+    fmat.Clear();
+    for (size_t i = 0; i < this->NumRow(); ++i) {
+      std::vector<bst_uint> findex;
+      std::vector<bst_float> value;
+      for (unsigned f = 0; f < nfeat; ++f) {
+        if (missing[i * nfeat + f] != 0) continue;
+        findex.push_back(f); value.push_back(fvalue[i * nfeat + f]);
+      }
+      fmat.AddRow(findex, value);
+    }
+    fmat.InitData();
+  }
+  inline size_t NumRow(void) const {
+    return labels.size();
+  }
+  inline unsigned Root(size_t i) const {
+    return roots.size() == 0 ? 0 : roots[i];
+  }
+};
+/*! \brief set the space separated name=value pairs of cfg */
+inline void SetParams(GBTree &gbm, const std::string &cfg) {
+  std::istringstream is(cfg);
+  std::string kv;
+  while (is >> kv) {
+    const size_t eq = kv.find('=');
+    utils::Assert(eq != std::string::npos, "SetParams: expect name=value");
+    gbm.SetParam(kv.substr(0, eq).c_str(), kv.substr(eq + 1).c_str());
+  }
+}
+/*!
+ * \brief train nround rounds of squared error on d, use_buffer chooses buffered prediction between the rounds
+ * \param qs_trees if not NULL, gets the number of trees of the quick scorer after the prediction of each round
+ */
+inline void Train(TestGBTree &gbm, const TestData &d, const std::string &cfg, int nround, bool use_buffer,
+                  std::vector<size_t> *qs_trees = NULL) {
+  std::ostringstream os;
+  os << "silent=1 bst:num_feature=" << d.fmat.NumCol() << " num_pbuffer=" << (use_buffer ? d.NumRow() : 0)
+     << " bst:num_roots=" << (d.roots.size() == 0 ? 1 : *std::max_element(d.roots.begin(), d.roots.end()) + 1)
+     << " " << cfg;
+  SetParams(gbm, os.str());
+  gbm.InitModel();
+  gbm.InitTrainer();
+  const size_t n = d.NumRow();
+  std::vector<float> preds(n), grad(n), hess(n, 1.0f);
+  for (int r = 0; r < nround; ++r) {
+    gbm.PredictBatch(d.fmat, d.roots, use_buffer ? 0 : -1, preds);
+    if (qs_trees != NULL) qs_trees->push_back(gbm.NumQuickScorerTree());
+    for (size_t i = 0; i < n; ++i) {
+      grad[i] = preds[i] - d.labels[i];
+    }
+    std::fill(hess.begin(), hess.end(), 1.0f);
+    gbm.DoBoost(grad, hess, d.fmat, d.roots);
+  }
+}
+/*! \brief leaf of tree reached by row i of d, found by RegTree::GetNext from the root of the row */
+inline int WalkLeaf(const RegTree &tree, const TestData &d, size_t i) {
+  int nid = static_cast<int>(d.Root(i));
+  while (!tree[nid].is_leaf()) {
+    const unsigned fid = tree[nid].split_index();
+    const bool unknown = fid >= d.nfeat || d.missing[i * d.nfeat + fid] != 0;
+    nid = tree.GetNext(nid, unknown ? 0.0f : d.fvalue[i * d.nfeat + fid], unknown);
+  }
+  return nid;
+}
+/*! \brief leaf value of tree for each row of d */
+inline std::vector<float> WalkAll(const RegTree &tree, const TestData &d) {
+  std::vector<float> out(d.NumRow());
+  for (size_t i = 0; i < out.size(); ++i) {
+    out[i] = tree[WalkLeaf(tree, d, i)].leaf_value();
+  }
+  return out;
+}
+
+/*! \brief gain of a node of the exact maker with the default lambda=1 and min_child_weight=1 */
+inline double NodeGain(double sum_grad, double sum_hess) {
+  return sum_hess < 1.0 ? 0.0 : sum_grad * sum_grad / (sum_hess + 1.0);
+}
+inline void TestExactGreedy(void) {
+  TestData d;
+  d.Init(600, 8, 0, 0, 1, 21);
+  const size_t n = d.NumRow();
+  // the first round starts from 0, the gradient of a row is minus its label, its hessian 1
+  double sum_grad = 0.0;
+  for (size_t i = 0; i < n; ++i) sum_grad -= d.labels[i];
+  const double root_gain = NodeGain(sum_grad, static_cast<double>(n));
+  // best split of the root by brute force: every cut between two distinct values of a feature,
+  // the missing rows of the feature going to either side
+  double best = 0.0;
+  for (unsigned f = 0; f < d.nfeat; ++f) {
+    std::vector< std::pair<float, double> > col;
+    for (size_t i = 0; i < n; ++i) {
+      if (d.missing[i * d.nfeat + f] == 0) col.push_back(std::make_pair(d.fvalue[i * d.nfeat + f], -d.labels[i]));
+    }
+    std::sort(col.begin(), col.end());
+    double gmiss = sum_grad, hmiss = static_cast<double>(n - col.size());
+    for (size_t k = 0; k < col.size(); ++k) gmiss -= col[k].second;
+    double gl = 0.0, hl = 0.0;
+    for (size_t k = 0; k < col.size(); ++k) {
+      gl += col[k].second; hl += 1.0;
+      if (k + 1 < col.size() && col[k + 1].first == col[k].first) continue;
+      for (int miss_left = 0; miss_left < 2; ++miss_left) {
+        const double g = gl + (miss_left != 0 ? gmiss : 0.0), h = hl + (miss_left != 0 ? hmiss : 0.0);
+        if (h >= static_cast<double>(n)) continue;
+        best = std::max(best, NodeGain(g, h) + NodeGain(sum_grad - g, static_cast<double>(n) - h) - root_gain);
+      }
+    }
+  }
+  TestGBTree stump;
+  Train(stump, d, "bst:tree_maker=0 bst:max_depth=1", 1, false);
+  const RegTree &tree = stump.Tree(0);
+  Expect(!tree[0].is_leaf(), "exact greedy: the root is not split");
+  if (tree[0].is_leaf()) return;
+  // the gain of the split of the tree, recomputed from the rows it sends left
+  double gl = 0.0, hl = 0.0;
+  for (size_t i = 0; i < n; ++i) {
+    if (WalkLeaf(tree, d, i) == tree[0].cleft()) {
+      gl -= d.labels[i]; hl += 1.0;
+    }
+  }
+  const double gain = NodeGain(gl, hl) + NodeGain(sum_grad - gl, static_cast<double>(n) - hl) - root_gain;
+  Expect(Near(gain, best, 1e-4), "exact greedy: split of gain %g, the best is %g", gain, best);
+  Expect(Near(tree.stat(0).loss_chg, best, 1e-4), "exact greedy: loss_chg %g, the best gain is %g",
+         tree.stat(0).loss_chg, best);
+  // the leaves, the ones at max_depth included, hold the weight and the statistics of their rows
+  TestGBTree deep;
+  Train(deep, d, "bst:tree_maker=0 bst:max_depth=3", 1, false);
+  const RegTree &t3 = deep.Tree(0);
+  std::vector<double> lgrad(t3.param.num_nodes, 0.0), lhess(t3.param.num_nodes, 0.0);
+  for (size_t i = 0; i < n; ++i) {
+    const int leaf = WalkLeaf(t3, d, i);
+    lgrad[leaf] -= d.labels[i]; lhess[leaf] += 1.0;
+  }
+  for (int nid = 0; nid < t3.param.num_nodes; ++nid) {
+    if (!t3[nid].is_leaf() || lhess[nid] == 0.0) continue;
+    const double weight = -lgrad[nid] / (lhess[nid] + 1.0);
+    Expect(Near(t3[nid].leaf_value(), weight * 0.3, 1e-5), "exact greedy: leaf %d value %g, expect %g",
+           nid, t3[nid].leaf_value(), weight * 0.3);
+    Expect(Near(t3.stat(nid).sum_hess, lhess[nid], 1e-5) && Near(t3.stat(nid).base_weight, weight, 1e-5),
+           "exact greedy: leaf %d sum_hess %g base_weight %g, expect %g %g", nid,
+           t3.stat(nid).sum_hess, t3.stat(nid).base_weight, lhess[nid], weight);
+  }
+}
+
+inline void TestPrune(void) {
+  TestData d;
+  d.Init(2000, 8, 0, 0, 1, 5);
+  TestGBTree gbm;
+  Train(gbm, d, "bst:max_depth=6 bst:tree_maker=0 bst:gamma=1", 8, false);
+  int npruned = 0;
+  for (size_t t = 0; t < gbm.NumBooster(); ++t) {
+    const RegTree &tree = gbm.Tree(t);
+    std::ostringstream os;
+    os << "prune tree " << t;
+    const std::string name = os.str();
+    if (tree.param.num_deleted == 0) continue;
+    ++npruned;
+    const std::vector<float> ref = WalkAll(tree, d);
+    // the saved tree holds the live nodes only
+    MemoryStream ms;
+    tree.SaveModel(ms);
+    RegTree loaded;
+    loaded.LoadModel(ms);
+    Expect(loaded.param.num_deleted == 0, "%s: %d deleted slots saved", name.c_str(), loaded.param.num_deleted);
+    Expect(loaded.param.num_nodes == tree.param.num_nodes - tree.param.num_deleted,
+           "%s: %d nodes loaded, %d live", name.c_str(), loaded.param.num_nodes,
+           tree.param.num_nodes - tree.param.num_deleted);
+    ExpectEqual(name + ": save and load", ref, WalkAll(loaded, d));
+    // Compact numbers the nodes breadth first, the children of a node are adjacent
+    RegTree dense(tree);
+    dense.Compact();
+    Expect(dense.param.num_deleted == 0 && dense.param.num_nodes == loaded.param.num_nodes,
+           "%s: Compact left %d nodes", name.c_str(), dense.param.num_nodes);
+    for (int i = 0; i < dense.param.num_nodes; ++i) {
+      if (dense[i].is_leaf()) continue;
+      const int cl = dense[i].cleft(), cr = dense[i].cright();
+      Expect(cl > i && cr == cl + 1 && dense[cl].parent() == i && dense[cr].parent() == i &&
+             dense[cl].is_left_child() && !dense[cr].is_left_child(),
+             "%s: Compact node %d has children %d %d", name.c_str(), i, cl, cr);
+    }
+    ExpectEqual(name + ": Compact", ref, WalkAll(dense, d));
+    // new children take the deleted slots before the node array grows
+    RegTree grown(tree);
+    int leaf = 0;
+    while (!grown[leaf].is_leaf()) leaf = grown[leaf].cleft();
+    grown.AddChilds(leaf);
+    const int cl = grown[leaf].cleft(), cr = grown[leaf].cright();
+    grown[leaf].set_split(1, 0.5f, true);
+    grown[cl].set_leaf(1.0f);
+    grown[cr].set_leaf(-1.0f);
+    Expect(grown.param.num_nodes == tree.param.num_nodes &&
+           grown.param.num_deleted == tree.param.num_deleted - 2,
+           "%s: AddChilds grew the tree to %d nodes, %d deleted", name.c_str(),
+           grown.param.num_nodes, grown.param.num_deleted);
+    Expect(cl < tree.param.num_nodes && cr < tree.param.num_nodes && tree[cl].is_root() && tree[cr].is_root(),
+           "%s: AddChilds did not reuse deleted slots, took %d %d", name.c_str(), cl, cr);
+    MemoryStream mg;
+    grown.SaveModel(mg);
+    RegTree gloaded;
+    gloaded.LoadModel(mg);
+    Expect(gloaded.param.num_deleted == 0, "%s: grown tree saved with deleted slots", name.c_str());
+    ExpectEqual(name + ": grown save and load", WalkAll(grown, d), WalkAll(gloaded, d));
+  }
+  Expect(npruned != 0, "prune: gamma=1 pruned no tree");
+}
+
+/*! \brief save gbm and load it into out */
+inline void SaveLoad(const GBTree &gbm, GBTree &out) {
+  MemoryStream ms;
+  gbm.SaveModel(ms);
+  out.LoadModel(ms);
+}
+/*! \brief whether node nid of tree is a live split, not the slot of a deleted node */
+inline bool IsLiveSplit(const RegTree &tree, int nid) {
+  return !tree[nid].is_leaf() && !(nid >= tree.param.num_roots && tree[nid].is_root());
+}
+inline void TestCategorical(void) {
+  const unsigned kcat = 40;
+  TestData d, unseen;
+  d.Init(3000, 6, 2, kcat, 1, 3);
+  // ids up to twice the ones seen in training
+  unseen.Init(1000, 6, 2, 2 * kcat, 1, 4);
+  const int max_cat_bins[] = {256, 8};
+  for (size_t k = 0; k < sizeof(max_cat_bins) / sizeof(max_cat_bins[0]); ++k) {
+    std::ostringstream os;
+    os << "categorical max_cat_bins=" << max_cat_bins[k];
+    const std::string name = os.str();
+    // the categories with a bin of their own: all of them, or the max_cat_bins - 1 most frequent ones
+    std::vector< std::vector<bool> > own(2, std::vector<bool>(kcat, true));
+    if (max_cat_bins[k] < static_cast<int>(kcat)) {
+      for (unsigned f = 0; f < 2; ++f) {
+        std::vector< std::pair<int, unsigned> > count(kcat);
+        for (unsigned c = 0; c < kcat; ++c) count[c] = std::make_pair(0, c);
+        for (size_t i = 0; i < d.NumRow(); ++i) {
+          if (d.missing[i * d.nfeat + f] == 0) --count[static_cast<unsigned>(d.fvalue[i * d.nfeat + f])].first;
+        }
+        std::sort(count.begin(), count.end());
+        for (unsigned c = max_cat_bins[k] - 1; c < kcat; ++c) own[f][count[c].second] = false;
+      }
+    }
+    TestGBTree gbm;
+    std::ostringstream cfg;
+    cfg << "bst:max_depth=5 bst:tree_maker=2 bst:fcat=0-2 bst:max_cat_bins=" << max_cat_bins[k];
+    Train(gbm, d, cfg.str(), 6, false);
+    int ncat_split = 0;
+    for (size_t t = 0; t < gbm.NumBooster(); ++t) {
+      const RegTree &tree = gbm.Tree(t);
+      for (int nid = 0; nid < tree.param.num_nodes; ++nid) {
+        if (!IsLiveSplit(tree, nid) || !tree[nid].is_categorical()) continue;
+        ++ncat_split;
+        const unsigned fid = tree[nid].split_index();
+        Expect(fid < 2, "%s: categorical split on numerical feature %u", name.c_str(), fid);
+        // the ids never seen and the folded categories go right
+        for (unsigned c = 0; c < 2 * kcat && fid < 2; ++c) {
+          Expect(!tree.CategoryGoLeft(nid, static_cast<float>(c)) || (c < kcat && own[fid][c]),
+                 "%s: tree %lu node %d sends category %u left", name.c_str(),
+                 static_cast<unsigned long>(t), nid, c);
+        }
+      }
+    }
+    Expect(ncat_split != 0, "%s: no categorical split", name.c_str());
+    // the category sets are saved with the trees
+    TestGBTree loaded;
+    SaveLoad(gbm, loaded);
+    Expect(loaded.NumBooster() == gbm.NumBooster(), "%s: boosters lost in save and load", name.c_str());
+    for (size_t t = 0; t < gbm.NumBooster() && t < loaded.NumBooster(); ++t) {
+      ExpectEqual(name + ": save and load", WalkAll(gbm.Tree(t), unseen), WalkAll(loaded.Tree(t), unseen));
+    }
+  }
+}
+
+inline void TestMultiRoot(void) {
+  const unsigned nroot = 3;
+  TestData d;
+  d.Init(1500, 8, 0, 0, nroot, 2);
+  const char *makers[] = {"0", "2", "3"};
+  for (size_t k = 0; k < sizeof(makers) / sizeof(makers[0]); ++k) {
+    const std::string name = std::string("num_roots=3 tree_maker=") + makers[k];
+    // only the exact maker reads the columns, the other ones are trained on the rows alone
+    if (k != 0) d.fmat.InitData(false);
+    TestGBTree gbm;
+    Train(gbm, d, std::string("bst:max_depth=4 bst:tree_maker=") + makers[k], 3, false);
+    const RegTree &tree = gbm.Tree(0);
+    Expect(tree.param.num_roots == static_cast<int>(nroot), "%s: %d roots", name.c_str(), tree.param.num_roots);
+    // each root grows its own subtree from its own rows, whose hessians sum to the number of rows
+    std::vector<double> root_hess(nroot, 0.0), leaf_hess(nroot, 0.0);
+    for (unsigned g = 0; g < nroot; ++g) {
+      Expect(!tree[g].is_leaf(), "%s: root %u is not split", name.c_str(), g);
+    }
+    for (size_t i = 0; i < d.NumRow(); ++i) {
+      int nid = WalkLeaf(tree, d, i);
+      while (!tree[nid].is_root()) nid = tree[nid].parent();
+      Expect(nid == static_cast<int>(d.Root(i)), "%s: row %lu of root %u reaches a leaf of root %d",
+             name.c_str(), static_cast<unsigned long>(i), d.Root(i), nid);
+      root_hess[d.Root(i)] += 1.0;
+    }
+    for (int nid = 0; nid < tree.param.num_nodes; ++nid) {
+      if (!tree[nid].is_leaf() || nid < tree.param.num_roots) continue;
+      int root = nid;
+      while (!tree[root].is_root()) root = tree[root].parent();
+      leaf_hess[root] += tree.stat(nid).sum_hess;
+    }
+    for (unsigned g = 0; g < nroot; ++g) {
+      Expect(Near(leaf_hess[g], root_hess[g], 1e-5), "%s: leaves of root %u hold %g rows of %g",
+             name.c_str(), g, leaf_hess[g], root_hess[g]);
+    }
+    TestGBTree loaded;
+    SaveLoad(gbm, loaded);
+    for (size_t t = 0; t < gbm.NumBooster(); ++t) {
+      ExpectEqual(name + ": save and load", WalkAll(gbm.Tree(t), d), WalkAll(loaded.Tree(t), d));
+    }
+  }
+}
+
+/*!
+ * \brief colsample_bylevel draws one sample per depth of a tree: a lossguide tree, which expands
+ *        nodes of a depth in several steps, splits each depth on the features of one sample
+ */
+inline void TestColumnSample(void) {
+  const unsigned nroot = 3;
+  TestData d;
+  d.Init(3000, 20, 0, 0, nroot, 9);
+  const char *policies[] = {"depthwise", "lossguide"};
+  for (size_t k = 0; k < sizeof(policies) / sizeof(policies[0]); ++k) {
+    const std::string name = std::string("colsample_bylevel grow_policy=") + policies[k];
+    TestGBTree gbm;
+    Train(gbm, d, std::string("bst:tree_maker=2 bst:max_depth=6 bst:max_leaves=40 bst:colsample_bylevel=0.1 "
+                              "bst:grow_policy=") + policies[k], 4, false);
+    for (size_t t = 0; t < gbm.NumBooster(); ++t) {
+      const RegTree &tree = gbm.Tree(t);
+      std::vector< std::set<unsigned> > used;
+      for (int nid = 0; nid < tree.param.num_nodes; ++nid) {
+        if (!IsLiveSplit(tree, nid)) continue;
+        const size_t depth = static_cast<size_t>(tree.GetDepth(nid));
+        if (used.size() <= depth) used.resize(depth + 1);
+        used[depth].insert(tree[nid].split_index());
+      }
+      for (size_t depth = 0; depth < used.size(); ++depth) {
+        Expect(used[depth].size() <= 2, "%s: tree %lu splits depth %lu on %lu features, the sample holds 2",
+               name.c_str(), static_cast<unsigned long>(t), static_cast<unsigned long>(depth),
+               static_cast<unsigned long>(used[depth].size()));
+      }
+    }
+  }
+}
+
+/*! \brief check that the quantized matrix of d gives back the bin of every value, and -1 for the missing ones */
+inline void CheckHistIndex(const std::string &name, const TestData &d, bool enable_bundle,
+                           bool expect_dense, bool expect_bundled) {
+  HistIndexMatrix m;
+  m.Init(d.fmat, d.NumRow(), 256, 1.0f / 256, std::vector<float>(), std::vector<bool>(), 256,
+         enable_bundle, 0.0f);
+  Expect(m.dense == expect_dense && m.IsBundled() == expect_bundled, "%s: dense=%d bundled=%d",
+         name.c_str(), static_cast<int>(m.dense), static_cast<int>(m.IsBundled()));
+  for (size_t i = 0; i < d.NumRow(); ++i) {
+    for (unsigned f = 0; f < d.nfeat; ++f) {
+      const int bin = m.GetBin(static_cast<bst_uint>(i), f);
+      const int expect = d.missing[i * d.nfeat + f] != 0 ? -1 :
+          static_cast<int>(m.cut.GetBin(f, d.fvalue[i * d.nfeat + f]));
+      if (bin == expect) continue;
+      Expect(false, "%s: row %lu feature %u in bin %d, expect %d", name.c_str(),
+             static_cast<unsigned long>(i), f, bin, expect);
+      return;
+    }
+  }
+}
+/*!
+ * \brief the quantized matrix stores the local bins as uint8_t in three layouts: dense rows,
+ *        sparse rows with the feature of each entry, and codes of bundled features;
+ *        each one gives back the bins and builds the same trees
+ */
+inline void TestHistIndex(void) {
+  TestData sparse, dense, onehot;
+  sparse.Init(2000, 6, 0, 0, 1, 11);
+  dense = sparse;
+  std::fill(dense.missing.begin(), dense.missing.end(), 0);
+  dense.InitMatrix();
+  // three one-hot groups of 8 columns and a numerical column with missing values
+  onehot.nfeat = 25;
+  random::XorShift rnd(12);
+  for (size_t i = 0; i < 2000; ++i) {
+    float label = 0.0f;
+    for (unsigned g = 0; g < 3; ++g) {
+      const unsigned c = static_cast<unsigned>(rnd.NextUInt64() % 8);
+      for (unsigned k = 0; k < 8; ++k) {
+        onehot.fvalue.push_back(k == c ? 1.0f : 0.0f); onehot.missing.push_back(k == c ? 0 : 1);
+      }
+      label += c % 3 == g ? 1.0f : 0.0f;
+    }
+    const bool miss = rnd.NextDouble() < 0.3;
+    const float v = static_cast<float>(rnd.NextUInt64() % 16);
+    onehot.fvalue.push_back(miss ? 0.0f : v); onehot.missing.push_back(miss ? 1 : 0);
+    onehot.labels.push_back(label + (miss ? 0.0f : v / 16.0f));
+  }
+  onehot.InitMatrix();
+  CheckHistIndex("hist index sparse", sparse, false, false, false);
+  CheckHistIndex("hist index dense", dense, false, true, false);
+  CheckHistIndex("hist index dense bundled", dense, true, false, true);
+  CheckHistIndex("hist index one-hot", onehot, false, false, false);
+  CheckHistIndex("hist index one-hot bundled", onehot, true, false, true);
+  const TestData *data[] = {&sparse, &dense, &onehot};
+  const char *names[] = {"sparse", "dense", "one-hot"};
+  for (size_t k = 0; k < sizeof(data) / sizeof(data[0]); ++k) {
+    const std::string name = std::string("hist index ") + names[k] + " layouts";
+    TestGBTree plain, bundled;
+    Train(plain, *data[k], "bst:max_depth=5 bst:tree_maker=2 bst:enable_bundle=0", 3, false);
+    Train(bundled, *data[k], "bst:max_depth=5 bst:tree_maker=2 bst:enable_bundle=1", 3, false);
+    for (size_t t = 0; t < plain.NumBooster(); ++t) {
+      ExpectEqual(name, WalkAll(plain.Tree(t), *data[k]), WalkAll(bundled.Tree(t), *data[k]));
+    }
+  }
+}
+
+/*!
+ * \brief models of each kind the inference paths handle, each with the rows it is checked on:
+ *        the rows it was trained on, and the same rows moved onto its split thresholds
+ */
+class TestZoo {
+ public:
+  struct Case {
+    std::string name;
+    TestGBTree *gbm;
+    const TestData *rows;
+    /*! \brief 1 if the quick scorer takes the trees, 0 if it refuses them, -1 either */
+    int expect_qs;
+  };
+  std::vector<Case> cases;
+  TestZoo(void) {
+    TestData *num = this->NewData(1500, 12, 0, 0, 1, 1);
+    const char *makers[] = {"0", "2", "3"};
+    for (size_t k = 0; k < sizeof(makers) / sizeof(makers[0]); ++k) {
+      const std::string cfg = std::string("bst:max_depth=6 bst:tree_maker=") + makers[k];
+      this->AddCases("numerical tree_maker=" + std::string(makers[k]), this->NewModel(*num, cfg, 6), *num, 1);
+    }
+    // deeper trees than the quick scorer takes
+    this->AddCases("numerical max_depth=10",
+                   this->NewModel(*num, "bst:max_depth=10 bst:tree_maker=2 bst:min_child_weight=0", 3), *num, -1);
+    TestData *multi = this->NewData(1500, 8, 0, 0, 3, 2);
+    this->AddCases("num_roots=3", this->NewModel(*multi, "bst:max_depth=4 bst:tree_maker=2", 5), *multi, 0);
+    TestData *cat = this->NewData(3000, 6, 2, 40, 1, 3);
+    // ids up to twice the ones seen in training
+    TestData *unseen = this->NewData(1000, 6, 2, 80, 1, 4);
+    const char *cfgs[] = {"bst:max_cat_bins=256", "bst:max_cat_bins=8"};
+    for (size_t k = 0; k < sizeof(cfgs) / sizeof(cfgs[0]); ++k) {
+      TestGBTree *gbm = this->NewModel(*cat, std::string("bst:max_depth=5 bst:tree_maker=2 bst:fcat=0-2 ") + cfgs[k], 6);
+      this->AddCases(std::string("categorical ") + cfgs[k], gbm, *cat, 0);
+      this->AddCases(std::string("categorical unseen ids ") + cfgs[k], gbm, *unseen, 0);
+      this->AddCases(std::string("categorical loaded ") + cfgs[k], this->NewLoaded(*gbm), *unseen, 0);
+    }
+    TestData *pruned = this->NewData(2000, 8, 0, 0, 1, 5);
+    TestGBTree *gbm = this->NewModel(*pruned, "bst:max_depth=6 bst:tree_maker=0 bst:gamma=1", 8);
+    this->AddCases("pruned", gbm, *pruned, 1);
+    this->AddCases("pruned loaded", this->NewLoaded(*gbm), *pruned, 1);
+  }
+  ~TestZoo(void) {
+    for (size_t i = 0; i < models_.size(); ++i) delete models_[i];
+    for (size_t i = 0; i < data_.size(); ++i) delete data_[i];
+  }
+
+ private:
+  // the zoo owns its models and rows
+  TestZoo(const TestZoo &other);
+  TestZoo &operator=(const TestZoo &other);
+  inline TestData *NewData(size_t nrow, unsigned nfeat, unsigned ncat, unsigned kcat,
+                           unsigned nroot, uint64_t seed) {
+    data_.push_back(new TestData());
+    data_.back()->Init(nrow, nfeat, ncat, kcat, nroot, seed);
+    return data_.back();
+  }
+  inline TestGBTree *NewModel(const TestData &d, const std::string &cfg, int nround) {
+    models_.push_back(new TestGBTree());
+    Train(*models_.back(), d, cfg, nround, false);
+    return models_.back();
+  }
+  inline TestGBTree *NewLoaded(const TestGBTree &gbm) {
+    models_.push_back(new TestGBTree());
+    SaveLoad(gbm, *models_.back());
+    return models_.back();
+  }
+  inline void AddCases(const std::string &name, TestGBTree *gbm, const TestData &d, int expect_qs) {
+    Case c;
+    c.name = name; c.gbm = gbm; c.rows = &d; c.expect_qs = expect_qs;
+    cases.push_back(c);
+    std::vector<const RegTree*> trees;
+    for (size_t t = 0; t < gbm->NumBooster(); ++t) {
+      trees.push_back(&gbm->Tree(t));
+    }
+    data_.push_back(new TestData(d));
+    data_.back()->MoveToThresholds(trees, 11);
+    c.name = name + " on thresholds"; c.rows = data_.back();
+    cases.push_back(c);
+  }
+  std::vector<TestGBTree*> models_;
+  std::vector<TestData*> data_;
+};
+/*! \brief sum of the walks of the trees of gbm for each row of d, in tree order like every inference path */
+inline std::vector<float> WalkSum(const TestGBTree &gbm, const TestData &d) {
+  std::vector<float> sum(d.NumRow(), 0.0f);
+  for (size_t t = 0; t < gbm.NumBooster(); ++t) {
+    const std::vector<float> ref = WalkAll(gbm.Tree(t), d);
+    for (size_t i = 0; i < sum.size(); ++i) sum[i] += ref[i];
+  }
+  return sum;
+}
+/*! \brief check GBTree::PredictBatch with the given quick_scorer and simd_traversal against the walks */
+inline void CheckBatch(const TestZoo::Case &c, int use_qs, int simd) {
+  c.gbm->SetParam("quick_scorer", use_qs != 0 ? "1" : "0");
+  c.gbm->SetParam("simd_traversal", simd != 0 ? "1" : "0");
+  std::vector<float> out(c.rows->NumRow());
+  c.gbm->PredictBatch(c.rows->fmat, c.rows->roots, -1, out);
+  std::ostringstream os;
+  os << c.name << ": PredictBatch quick_scorer=" << use_qs << " simd_traversal=" << simd;
+  ExpectEqual(os.str(), WalkSum(*c.gbm, *c.rows), out);
+}
+inline void TestBatchPredict(const TestZoo &zoo) {
+  // the tiles of rows go through all the trees together, the sums are the ones of the walks
+  for (size_t k = 0; k < zoo.cases.size(); ++k) {
+    CheckBatch(zoo.cases[k], 0, 0);
+  }
+}
+
+inline void TestEmptyFeatures(const TestZoo &zoo) {
+  // rows without any feature, all the rows take the default directions
+  TestData empty;
+  empty.Init(100, 0, 0, 0, 1, 7);
+  for (size_t k = 0; k < zoo.cases.size(); ++k) {
+    if (zoo.cases[k].rows->roots.size() != 0) continue;
+    TestZoo::Case c = zoo.cases[k];
+    c.name += " without features";
+    c.rows = &empty;
+    for (int use_qs = 0; use_qs < 2; ++use_qs) {
+      CheckBatch(c, use_qs, 0);
+      CheckBatch(c, use_qs, 1);
+    }
+  }
+}
+
+inline void TestFlatLayout(const TestZoo &zoo) {
+  // each packed tree gives the leaf of the walk of its tree
+  for (size_t k = 0; k < zoo.cases.size(); ++k) {
+    const TestZoo::Case &c = zoo.cases[k];
+    const TestData &d = *c.rows;
+    const size_t nf = d.nfeat;
+    FlatTreeEnsemble flat;
+    for (size_t t = 0; t < c.gbm->NumBooster(); ++t) {
+      flat.AddTree(c.gbm->Tree(t));
+      std::vector<float> out(d.NumRow());
+      for (size_t i = 0; i < out.size(); ++i) {
+        out[i] = flat.Predict(t, DenseRow<float>(&d.fvalue[i * nf], nf),
+                              DenseRow<int>(&d.missing[i * nf], nf), d.Root(i));
+      }
+      std::ostringstream os;
+      os << c.name << ": flat tree " << t;
+      ExpectEqual(os.str(), WalkAll(c.gbm->Tree(t), d), out);
+    }
+  }
+}
+
+inline void TestQuickScorer(const TestZoo &zoo) {
+  for (size_t k = 0; k < zoo.cases.size(); ++k) {
+    const TestZoo::Case &c = zoo.cases[k];
+    const TestData &d = *c.rows;
+    const size_t nf = d.nfeat;
+    QuickScorer qs;
+    bool qs_ok = true;
+    for (size_t t = 0; t < c.gbm->NumBooster() && qs_ok; ++t) {
+      qs_ok = qs.AddTree(c.gbm->Tree(t));
+    }
+    Expect(c.expect_qs < 0 || qs_ok == (c.expect_qs != 0), "%s: quick scorer %s the trees",
+           c.name.c_str(), qs_ok ? "takes" : "refuses");
+    if (qs_ok) {
+      // the scorer sums the trees in tree order, like the walks
+      qs.Finalize();
+      std::vector<float> out(d.NumRow());
+      std::vector<uint64_t> v;
+      for (size_t i = 0; i < out.size(); ++i) {
+        out[i] = qs.Predict(DenseRow<float>(&d.fvalue[i * nf], nf),
+                            DenseRow<int>(&d.missing[i * nf], nf), 0.0f, v);
+      }
+      ExpectEqual(c.name + ": quick scorer", WalkSum(*c.gbm, d), out);
+    }
+    CheckBatch(c, 1, 0);
+  }
+}
+
+inline void TestBufferedPredict(void) {
+  TestData d;
+  d.Init(1500, 10, 0, 0, 1, 6);
+  // buffered rows resume after the trees they have, the quick scorer would scan all the trees for
+  // them, so training with the buffer never builds it, nor finalizes it after each round
+  TestGBTree gbm;
+  std::vector<size_t> qs_trees;
+  Train(gbm, d, "bst:max_depth=5 bst:tree_maker=2", 20, true, &qs_trees);
+  for (size_t r = 0; r < qs_trees.size(); ++r) {
+    Expect(qs_trees[r] == 0, "buffered: quick scorer built with %lu trees in round %lu",
+           static_cast<unsigned long>(qs_trees[r]), static_cast<unsigned long>(r));
+  }
+  // the buffer holds the sums of the first trees, adding the last tree gives the sum of the walks
+  std::vector<float> buffered(d.NumRow());
+  gbm.PredictBatch(d.fmat, d.roots, 0, buffered);
+  Expect(gbm.NumQuickScorerTree() == 0, "buffered: quick scorer built by the last prediction");
+  ExpectEqual("buffered: PredictBatch", WalkSum(gbm, d), buffered);
+  // unbuffered prediction needs every tree, it builds the scorer once for all of them
+  std::vector<float> unbuffered(d.NumRow());
+  gbm.PredictBatch(d.fmat, d.roots, -1, unbuffered);
+  ExpectEqual("buffered: unbuffered PredictBatch", WalkSum(gbm, d), unbuffered);
+  Expect(gbm.NumQuickScorerTree() == gbm.NumBooster(), "buffered: quick scorer holds %lu of %lu trees",
+         static_cast<unsigned long>(gbm.NumQuickScorerTree()), static_cast<unsigned long>(gbm.NumBooster()));
+}
+
+inline void TestBlockTraversal(const TestZoo &zoo) {
+  // the rows go through each tree in lockstep at every instruction set the cpu runs, the last
+  // rows of the block that fill no vector take the scalar path
+  for (size_t k = 0; k < zoo.cases.size(); ++k) {
+    const TestZoo::Case &c = zoo.cases[k];
+    const TestData &d = *c.rows;
+    FlatTreeEnsemble flat;
+    for (size_t t = 0; t < c.gbm->NumBooster(); ++t) {
+      flat.AddTree(c.gbm->Tree(t));
+      const std::vector<float> ref = WalkAll(c.gbm->Tree(t), d);
+      for (int simd = FlatTreeEnsemble::kScalar; simd <= FlatTreeEnsemble::DetectSIMD(); ++simd) {
+        std::vector<float> out(d.NumRow(), 0.0f);
+        flat.PredictBlock(t, &d.fvalue[0], &d.missing[0], d.nfeat, d.NumRow(),
+                          d.roots.size() == 0 ? NULL : &d.roots[0], &out[0], simd);
+        std::ostringstream os;
+        os << c.name << ": block simd " << simd << " tree " << t;
+        ExpectEqual(os.str(), ref, out);
+      }
+    }
+    CheckBatch(c, 0, 1);
+    CheckBatch(c, 1, 1);
+  }
+}
+}  // namespace
+
+int main(void) {
+  TestExactGreedy();
+  TestPrune();
+  TestCategorical();
+  TestMultiRoot();
+  TestColumnSample();
+  TestHistIndex();
+  TestZoo zoo;
+  TestBatchPredict(zoo);
+  TestEmptyFeatures(zoo);
+  TestFlatLayout(zoo);
+  TestQuickScorer(zoo);
+  TestBufferedPredict();
+  TestBlockTraversal(zoo);
+  if (num_failed != 0) {
+    fprintf(stderr, "%d checks failed\n", num_failed);
+    return 1;
+  }
+  printf("all tests passed, simd level %d\n", FlatTreeEnsemble::DetectSIMD());
+  return 0;
+}